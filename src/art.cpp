@@ -0,0 +1,677 @@
+#include "art.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum : uint8_t {
+    ART_N4 = 1,
+    ART_N16 = 2,
+    ART_N48 = 3,
+    ART_N256 = 4,
+};
+
+struct ArtNode {
+    uint8_t type = 0;
+    uint8_t pkey = 0; // the byte of its slot in `parent`
+    uint16_t nchild = 0;
+    ArtNode *parent = nullptr;
+    ArtLeaf *term = nullptr; // the key ending right after `prefix`
+    std::string prefix;      // the bytes after `pkey` shared by all the keys
+};
+
+// sorted `keys`
+struct ArtNode4 : ArtNode {
+    uint8_t keys[4] = {};
+    void *child[4] = {};
+};
+
+struct ArtNode16 : ArtNode {
+    uint8_t keys[16] = {};
+    void *child[16] = {};
+};
+
+// `index[byte]` is the slot + 1, 0 if none
+struct ArtNode48 : ArtNode {
+    uint8_t index[256] = {};
+    void *child[48] = {};
+};
+
+struct ArtNode256 : ArtNode {
+    void *child[256] = {};
+};
+
+// the leaves are tagged with the low bit
+static bool is_leaf(void *p) { return (uintptr_t)p & 1; }
+static ArtLeaf *as_leaf(void *p) { return (ArtLeaf *)((uintptr_t)p & ~(uintptr_t)1); }
+static void *tag_leaf(ArtLeaf *leaf) { return (void *)((uintptr_t)leaf | 1); }
+
+static ArtNode *node_new(ArtTree *tree, uint8_t type) {
+    ArtNode *n = nullptr;
+    switch (type) {
+    case ART_N4:
+        n = new ArtNode4();
+        tree->bytes += sizeof(ArtNode4);
+        break;
+    case ART_N16:
+        n = new ArtNode16();
+        tree->bytes += sizeof(ArtNode16);
+        break;
+    case ART_N48:
+        n = new ArtNode48();
+        tree->bytes += sizeof(ArtNode48);
+        break;
+    default:
+        n = new ArtNode256();
+        tree->bytes += sizeof(ArtNode256);
+        break;
+    }
+    n->type = type;
+    tree->nodes++;
+    return n;
+}
+
+static void node_free(ArtTree *tree, ArtNode *n) {
+    switch (n->type) {
+    case ART_N4:
+        delete (ArtNode4 *)n;
+        tree->bytes -= sizeof(ArtNode4);
+        break;
+    case ART_N16:
+        delete (ArtNode16 *)n;
+        tree->bytes -= sizeof(ArtNode16);
+        break;
+    case ART_N48:
+        delete (ArtNode48 *)n;
+        tree->bytes -= sizeof(ArtNode48);
+        break;
+    default:
+        delete (ArtNode256 *)n;
+        tree->bytes -= sizeof(ArtNode256);
+        break;
+    }
+    tree->nodes--;
+}
+
+static void **find_child(ArtNode *n, uint8_t b) {
+    switch (n->type) {
+    case ART_N4: {
+        ArtNode4 *n4 = (ArtNode4 *)n;
+        for (uint16_t i = 0; i < n->nchild; ++i) {
+            if (n4->keys[i] == b) {
+                return &n4->child[i];
+            }
+        }
+        return nullptr;
+    }
+    case ART_N16: {
+        ArtNode16 *n16 = (ArtNode16 *)n;
+#ifdef __SSE2__
+        __m128i keys = _mm_loadu_si128((const __m128i *)n16->keys);
+        __m128i match = _mm_cmpeq_epi8(keys, _mm_set1_epi8((char)b));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(match) &
+                        ((1u << n->nchild) - 1);
+        return bits ? &n16->child[__builtin_ctz(bits)] : nullptr;
+#else
+        for (uint16_t i = 0; i < n->nchild; ++i) {
+            if (n16->keys[i] == b) {
+                return &n16->child[i];
+            }
+        }
+        return nullptr;
+#endif
+    }
+    case ART_N48: {
+        ArtNode48 *n48 = (ArtNode48 *)n;
+        uint8_t idx = n48->index[b];
+        return idx ? &n48->child[idx - 1] : nullptr;
+    }
+    default: {
+        ArtNode256 *n256 = (ArtNode256 *)n;
+        return n256->child[b] ? &n256->child[b] : nullptr;
+    }
+    }
+}
+
+/**
+ * The first child whose byte is >= `from`, in `*b`
+ */
+static void *next_child(ArtNode *n, uint32_t from, uint8_t *b) {
+    switch (n->type) {
+    case ART_N4:
+    case ART_N16: {
+        uint8_t *keys = n->type == ART_N4 ? ((ArtNode4 *)n)->keys
+                                          : ((ArtNode16 *)n)->keys;
+        void **child = n->type == ART_N4 ? ((ArtNode4 *)n)->child
+                                         : ((ArtNode16 *)n)->child;
+        for (uint16_t i = 0; i < n->nchild; ++i) {
+            if (keys[i] >= from) {
+                *b = keys[i];
+                return child[i];
+            }
+        }
+        return nullptr;
+    }
+    case ART_N48: {
+        ArtNode48 *n48 = (ArtNode48 *)n;
+        for (uint32_t i = from; i < 256; ++i) {
+            if (n48->index[i]) {
+                *b = (uint8_t)i;
+                return n48->child[n48->index[i] - 1];
+            }
+        }
+        return nullptr;
+    }
+    default: {
+        ArtNode256 *n256 = (ArtNode256 *)n;
+        for (uint32_t i = from; i < 256; ++i) {
+            if (n256->child[i]) {
+                *b = (uint8_t)i;
+                return n256->child[i];
+            }
+        }
+        return nullptr;
+    }
+    }
+}
+
+static void set_parent(void *child, ArtNode *parent, uint8_t b) {
+    if (is_leaf(child)) {
+        ArtLeaf *leaf = as_leaf(child);
+        leaf->parent = parent;
+        leaf->pkey = b;
+        leaf->term = false;
+    } else {
+        ((ArtNode *)child)->parent = parent;
+        ((ArtNode *)child)->pkey = b;
+    }
+}
+
+static void set_term(ArtNode *n, ArtLeaf *leaf) {
+    n->term = leaf;
+    leaf->parent = n;
+    leaf->pkey = 0;
+    leaf->term = true;
+}
+
+// the slot holding `n`
+static void **node_ref(ArtTree *tree, ArtNode *n) {
+    if (!n->parent) {
+        return &tree->root;
+    }
+    void **ref = find_child(n->parent, n->pkey);
+    assert(ref && *ref == n);
+    return ref;
+}
+
+/**
+ * Add to a node that has room, keeping N4/N16 sorted
+ */
+static void node_add(ArtNode *n, uint8_t b, void *child) {
+    switch (n->type) {
+    case ART_N4:
+    case ART_N16: {
+        uint8_t *keys = n->type == ART_N4 ? ((ArtNode4 *)n)->keys
+                                          : ((ArtNode16 *)n)->keys;
+        void **children = n->type == ART_N4 ? ((ArtNode4 *)n)->child
+                                            : ((ArtNode16 *)n)->child;
+        uint16_t i = n->nchild;
+        while (i > 0 && keys[i - 1] > b) {
+            keys[i] = keys[i - 1];
+            children[i] = children[i - 1];
+            --i;
+        }
+        keys[i] = b;
+        children[i] = child;
+        break;
+    }
+    case ART_N48: {
+        ArtNode48 *n48 = (ArtNode48 *)n;
+        uint8_t slot = 0;
+        while (n48->child[slot]) {
+            ++slot;
+        }
+        n48->child[slot] = child;
+        n48->index[b] = slot + 1;
+        break;
+    }
+    default:
+        ((ArtNode256 *)n)->child[b] = child;
+        break;
+    }
+    n->nchild++;
+    set_parent(child, n, b);
+}
+
+static void node_remove(ArtNode *n, uint8_t b) {
+    switch (n->type) {
+    case ART_N4:
+    case ART_N16: {
+        uint8_t *keys = n->type == ART_N4 ? ((ArtNode4 *)n)->keys
+                                          : ((ArtNode16 *)n)->keys;
+        void **children = n->type == ART_N4 ? ((ArtNode4 *)n)->child
+                                            : ((ArtNode16 *)n)->child;
+        uint16_t i = 0;
+        while (keys[i] != b) {
+            ++i;
+        }
+        for (; i + 1 < n->nchild; ++i) {
+            keys[i] = keys[i + 1];
+            children[i] = children[i + 1];
+        }
+        break;
+    }
+    case ART_N48: {
+        ArtNode48 *n48 = (ArtNode48 *)n;
+        n48->child[n48->index[b] - 1] = nullptr;
+        n48->index[b] = 0;
+        break;
+    }
+    default:
+        ((ArtNode256 *)n)->child[b] = nullptr;
+        break;
+    }
+    n->nchild--;
+}
+
+/**
+ * Move everything from `old` to a node of another type, which takes its
+ * place at `ref`
+ */
+static ArtNode *node_retype(ArtTree *tree, void **ref, ArtNode *old,
+                            uint8_t type) {
+    ArtNode *n = node_new(tree, type);
+    n->pkey = old->pkey;
+    n->parent = old->parent;
+    n->prefix = std::move(old->prefix);
+    if (old->term) {
+        set_term(n, old->term);
+    }
+    uint8_t b = 0;
+    for (uint32_t from = 0; from < 256; from = (uint32_t)b + 1) {
+        void *child = next_child(old, from, &b);
+        if (!child) {
+            break;
+        }
+        node_add(n, b, child);
+    }
+    *ref = n;
+    node_free(tree, old);
+    return n;
+}
+
+static uint16_t node_capacity(ArtNode *n) {
+    switch (n->type) {
+    case ART_N4:
+        return 4;
+    case ART_N16:
+        return 16;
+    case ART_N48:
+        return 48;
+    default:
+        return 256;
+    }
+}
+
+static void add_child(ArtTree *tree, void **ref, ArtNode *n, uint8_t b,
+                      void *child) {
+    if (n->nchild == node_capacity(n)) {
+        n = node_retype(tree, ref, n, (uint8_t)(n->type + 1));
+    }
+    node_add(n, b, child);
+}
+
+// drop the first `n` bytes of a prefix, a short one goes back inline
+static void key_cut(std::string &key, size_t n) {
+    key.erase(0, n);
+    key.shrink_to_fit();
+}
+
+// the bytes of the key below the slot of the leaf
+static std::string_view leaf_suffix(ArtTree *tree, ArtLeaf *leaf) {
+    return tree->leaf_key(leaf).substr(leaf->skip);
+}
+
+// common length of `a` and `b[from:]`
+static size_t common_len(std::string_view a, std::string_view b, size_t from) {
+    size_t n = b.size() - from < a.size() ? b.size() - from : a.size();
+    size_t i = 0;
+    while (i < n && a[i] == b[from + i]) {
+        ++i;
+    }
+    return i;
+}
+
+ArtLeaf *art_lookup(ArtTree *tree, std::string_view key) {
+    void *cur = tree->root;
+    size_t depth = 0;
+    while (cur) {
+        if (is_leaf(cur)) {
+            ArtLeaf *leaf = as_leaf(cur);
+            return key.substr(depth) == leaf_suffix(tree, leaf) ? leaf
+                                                                : nullptr;
+        }
+
+        ArtNode *n = (ArtNode *)cur;
+        const std::string &prefix = n->prefix;
+        if (key.size() - depth < prefix.size() ||
+            0 != memcmp(key.data() + depth, prefix.data(), prefix.size())) {
+            return nullptr;
+        }
+        depth += prefix.size();
+        if (depth == key.size()) {
+            return n->term;
+        }
+        void **slot = find_child(n, (uint8_t)key[depth]);
+        if (!slot) {
+            return nullptr;
+        }
+        cur = *slot;
+        depth++;
+    }
+    return nullptr;
+}
+
+ArtLeaf *art_insert(ArtTree *tree, ArtLeaf *leaf) {
+    std::string_view key = tree->leaf_key(leaf);
+    void **ref = &tree->root;
+    ArtNode *parent = nullptr;
+    uint8_t pb = 0; // the byte of `ref` in `parent`
+    size_t depth = 0;
+
+    while (true) {
+        void *cur = *ref;
+        if (!cur) {
+            leaf->skip = (uint32_t)depth;
+            *ref = tag_leaf(leaf);
+            set_parent(*ref, parent, pb);
+            break;
+        }
+
+        if (is_leaf(cur)) {
+            // split the leaf: a node with the common part as its prefix
+            ArtLeaf *old = as_leaf(cur);
+            std::string_view suffix = leaf_suffix(tree, old);
+            size_t c = common_len(suffix, key, depth);
+            if (c == suffix.size() && depth + c == key.size()) {
+                return old;
+            }
+
+            ArtNode *n = node_new(tree, ART_N4);
+            n->prefix.assign(suffix, 0, c);
+            n->parent = parent;
+            n->pkey = pb;
+            if (c == suffix.size()) {
+                old->skip += (uint32_t)suffix.size();
+                set_term(n, old);
+            } else {
+                uint8_t b = (uint8_t)suffix[c];
+                old->skip += (uint32_t)(c + 1);
+                node_add(n, b, tag_leaf(old));
+            }
+            if (depth + c == key.size()) {
+                leaf->skip = (uint32_t)key.size();
+                set_term(n, leaf);
+            } else {
+                uint8_t b = (uint8_t)key[depth + c];
+                leaf->skip = (uint32_t)(depth + c + 1);
+                node_add(n, b, tag_leaf(leaf));
+            }
+            *ref = n;
+            break;
+        }
+
+        ArtNode *n = (ArtNode *)cur;
+        size_t c = common_len(n->prefix, key, depth);
+        if (c < n->prefix.size()) {
+            // split the prefix: a new node above `n`
+            ArtNode *m = node_new(tree, ART_N4);
+            m->prefix.assign(n->prefix, 0, c);
+            m->parent = n->parent;
+            m->pkey = n->pkey;
+            uint8_t b = (uint8_t)n->prefix[c];
+            key_cut(n->prefix, c + 1);
+            node_add(m, b, n);
+            if (depth + c == key.size()) {
+                leaf->skip = (uint32_t)key.size();
+                set_term(m, leaf);
+            } else {
+                b = (uint8_t)key[depth + c];
+                leaf->skip = (uint32_t)(depth + c + 1);
+                node_add(m, b, tag_leaf(leaf));
+            }
+            *ref = m;
+            break;
+        }
+
+        depth += c;
+        if (depth == key.size()) {
+            if (n->term) {
+                return n->term;
+            }
+            leaf->skip = (uint32_t)key.size();
+            set_term(n, leaf);
+            break;
+        }
+        uint8_t b = (uint8_t)key[depth];
+        void **slot = find_child(n, b);
+        if (!slot) {
+            leaf->skip = (uint32_t)(depth + 1);
+            add_child(tree, ref, n, b, tag_leaf(leaf));
+            break;
+        }
+        ref = slot;
+        parent = n;
+        pb = b;
+        depth++;
+    }
+
+    tree->size++;
+    return nullptr;
+}
+
+/**
+ * A node left with a single entry is merged into it
+ */
+static void node_collapse(ArtTree *tree, void **ref, ArtNode *n) {
+    void *only = nullptr;
+    std::string head = std::move(n->prefix);
+    if (n->term) {
+        only = tag_leaf(n->term);
+    } else {
+        uint8_t b = 0;
+        only = next_child(n, 0, &b);
+        head.push_back((char)b);
+    }
+
+    if (is_leaf(only)) {
+        as_leaf(only)->skip -= (uint32_t)head.size();
+    } else {
+        ((ArtNode *)only)->prefix.insert(0, head);
+    }
+    set_parent(only, n->parent, n->pkey);
+    *ref = only;
+    node_free(tree, n);
+}
+
+// shrink with some hysteresis, so a node at the limit does not flip-flop
+static void node_maybe_shrink(ArtTree *tree, void **ref, ArtNode *n) {
+    if (n->type == ART_N256 && n->nchild <= 37) {
+        node_retype(tree, ref, n, ART_N48);
+    } else if (n->type == ART_N48 && n->nchild <= 12) {
+        node_retype(tree, ref, n, ART_N16);
+    } else if (n->type == ART_N16 && n->nchild <= 3) {
+        node_retype(tree, ref, n, ART_N4);
+    }
+}
+
+void art_detach(ArtTree *tree, ArtLeaf *leaf) {
+    ArtNode *n = leaf->parent;
+    tree->size--;
+    if (!n) {
+        tree->root = nullptr;
+        return;
+    }
+
+    if (leaf->term) {
+        n->term = nullptr;
+    } else {
+        node_remove(n, leaf->pkey);
+    }
+    *leaf = ArtLeaf{};
+
+    // a node always has 2 entries or more
+    void **ref = node_ref(tree, n);
+    if (n->nchild + (n->term ? 1 : 0) == 1) {
+        node_collapse(tree, ref, n);
+    } else {
+        node_maybe_shrink(tree, ref, n);
+    }
+}
+
+ArtLeaf *art_pop(ArtTree *tree, std::string_view key) {
+    ArtLeaf *leaf = art_lookup(tree, key);
+    if (leaf) {
+        art_detach(tree, leaf);
+    }
+    return leaf;
+}
+
+struct ArtWalk {
+    ArtTree *tree;
+    std::string path; // the key bytes down to the current node
+    std::string_view start;
+    bool (*f)(ArtLeaf *leaf, const std::string &key, void *arg);
+    void *arg;
+};
+
+/**
+ * `bounded`: the path is a prefix of `start`, the keys below can be smaller
+ * Returns false once `f` asked to stop
+ */
+static bool walk(ArtWalk *w, void *cur, bool bounded) {
+    size_t base = w->path.size();
+    if (is_leaf(cur)) {
+        ArtLeaf *leaf = as_leaf(cur);
+        w->path += leaf_suffix(w->tree, leaf);
+        bool ok = true;
+        if (!bounded || w->path.compare(w->start) >= 0) {
+            ok = w->f(leaf, w->path, w->arg);
+        }
+        w->path.resize(base);
+        return ok;
+    }
+
+    ArtNode *n = (ArtNode *)cur;
+    w->path += n->prefix;
+    if (bounded) {
+        size_t len = w->path.size() < w->start.size() ? w->path.size()
+                                                      : w->start.size();
+        int cmp = memcmp(w->path.data(), w->start.data(), len);
+        if (cmp < 0) {
+            w->path.resize(base);
+            return true; // the whole subtree is below `start`
+        }
+        bounded = cmp == 0 && w->start.size() > w->path.size();
+    }
+
+    bool ok = true;
+    // the term key is the path itself, below `start` if still bounded
+    if (n->term && !bounded) {
+        ok = w->f(n->term, w->path, w->arg);
+    }
+
+    uint32_t from = bounded ? (uint8_t)w->start[w->path.size()] : 0;
+    uint8_t b = 0;
+    while (ok && from < 256) {
+        void *child = next_child(n, from, &b);
+        if (!child) {
+            break;
+        }
+        bool child_bounded = bounded && b == (uint8_t)w->start[w->path.size()];
+        w->path.push_back((char)b);
+        ok = walk(w, child, child_bounded);
+        w->path.pop_back();
+        from = (uint32_t)b + 1;
+    }
+
+    w->path.resize(base);
+    return ok;
+}
+
+void art_walk(ArtTree *tree, std::string_view start,
+              bool (*f)(ArtLeaf *leaf, const std::string &key, void *arg),
+              void *arg) {
+    if (!tree->root) {
+        return;
+    }
+    ArtWalk w{tree, std::string(), start, f, arg};
+    walk(&w, tree->root, !start.empty());
+}
+
+// the `i`-th child in slot order, `i < nchild`
+static void *nth_child(ArtNode *n, uint32_t i) {
+    switch (n->type) {
+    case ART_N4:
+        return ((ArtNode4 *)n)->child[i];
+    case ART_N16:
+        return ((ArtNode16 *)n)->child[i];
+    case ART_N48: {
+        void **child = ((ArtNode48 *)n)->child;
+        uint32_t slot = 0;
+        for (; !child[slot] || i-- > 0; ++slot) {
+        }
+        return child[slot];
+    }
+    default: {
+        void **child = ((ArtNode256 *)n)->child;
+        uint32_t slot = 0;
+        for (; !child[slot] || i-- > 0; ++slot) {
+        }
+        return child[slot];
+    }
+    }
+}
+
+ArtLeaf *art_random(ArtTree *tree, uint64_t rnd) {
+    void *cur = tree->root;
+    while (cur && !is_leaf(cur)) {
+        ArtNode *n = (ArtNode *)cur;
+        // the children, plus the term key
+        uint32_t nopts = n->nchild + (n->term ? 1 : 0);
+        uint32_t i = (uint32_t)((rnd >> 32) % nopts);
+        rnd = rnd * 6364136223846793005ull + 1442695040888963407ull;
+        if (i == n->nchild) {
+            return n->term;
+        }
+        cur = nth_child(n, i);
+    }
+    return cur ? as_leaf(cur) : nullptr;
+}
+
+static void node_destroy(ArtTree *tree, void *cur) {
+    if (!cur || is_leaf(cur)) {
+        return;
+    }
+    ArtNode *n = (ArtNode *)cur;
+    uint8_t b = 0;
+    for (uint32_t from = 0; from < 256; from = (uint32_t)b + 1) {
+        void *child = next_child(n, from, &b);
+        if (!child) {
+            break;
+        }
+        node_destroy(tree, child);
+    }
+    node_free(tree, n);
+}
+
+void art_destroy(ArtTree *tree) {
+    node_destroy(tree, tree->root);
+    tree->root = nullptr;
+    tree->size = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef ART_H
+#define ART_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Adaptive radix tree over byte-string keys
+ * - inner nodes come in 4 sizes (4, 16, 48 and 256 children) and grow or
+ *   shrink with the number of children
+ * - path compression: a node with a single child is merged into it, the
+ *   skipped bytes become the `prefix` of the node; the prefixes are stored
+ *   in full, so a point lookup never has to re-check the key at the leaf
+ * - the keys are ordered (bytes compared unsigned), which gives prefix and
+ *   range iteration in time proportional to the result
+ */
+struct ArtNode;
+
+/**
+ * Intrusive leaf, embedded in the value like `HNode`
+ * The key is owned by the value (`ArtTree::leaf_key`) and does not change
+ * while in a tree; the leaf only compares the bytes below its slot, the
+ * first `skip` bytes are held by the inner nodes above
+ * Trivial, so it can share a union with `HNode`: `art_insert()` sets it all
+ */
+struct ArtLeaf {
+    ArtNode *parent;
+    uint8_t pkey;  // the byte of its slot in `parent`
+    bool term;     // the key ends with the prefix of `parent`
+    uint32_t skip; // bytes of the key above the leaf
+};
+
+struct ArtTree {
+    void *root = nullptr; // a leaf (tagged pointer) or a node
+    size_t size = 0;      // leaves
+    size_t nodes = 0;     // inner nodes
+    size_t bytes = 0;     // of the inner nodes, without long prefixes
+    std::string_view (*leaf_key)(ArtLeaf *leaf) = nullptr; // the full key
+};
+
+ArtLeaf *art_lookup(ArtTree *tree, std::string_view key);
+
+/**
+ * Returns the leaf already holding the key (nothing is inserted), or NULL
+ */
+ArtLeaf *art_insert(ArtTree *tree, ArtLeaf *leaf);
+
+// remove the leaf
+void art_detach(ArtTree *tree, ArtLeaf *leaf);
+
+ArtLeaf *art_pop(ArtTree *tree, std::string_view key);
+
+/**
+ * In order, from the first key >= `start`, until `f` returns false
+ * `key` is the full key of the leaf
+ */
+void art_walk(ArtTree *tree, std::string_view start,
+              bool (*f)(ArtLeaf *leaf, const std::string &key, void *arg),
+              void *arg);
+
+/**
+ * A leaf picked by walking down from the root, a child drawn from `rnd` at
+ * each node: not uniform, the leaves of the small subtrees come up more
+ * often; NULL if the tree is empty
+ */
+ArtLeaf *art_random(ArtTree *tree, uint64_t rnd);
+
+// free the inner nodes, the leaves belong to the caller
+void art_destroy(ArtTree *tree);
+
+#endif /* ART_H */
@@ -37,4 +37,98 @@ AVLNode *avl_delete(AVLNode *node);
  */
 AVLNode *avl_offset(AVLNode *node, int64_t offset);
 
+/**
+ * `avl_offset()` for a reader racing with the writer (`--shared-reads`):
+ * `valid()` is checked before every hop and a missing link ends the walk,
+ * both return NULL; the caller then retries on a consistent tree
+ */
+template <typename Valid>
+inline AVLNode *avl_offset_if(AVLNode *node, int64_t offset, Valid &&valid) {
+    // offset is number of nodes we walk to get to the destination node
+    // offset can be negative if we need to walk upwards then go left
+    int64_t pos = 0; // relative to the starting node
+    while (offset != pos) {
+        if (!valid()) {
+            return nullptr;
+        }
+        if (pos < offset && pos + avl_count(node->right) >= offset) {
+            // target is inside the right subtree
+            node = node->right;
+            if (!node) {
+                return nullptr;
+            }
+            pos += avl_count(node->left) + 1;
+        } else if (pos > offset && pos - avl_count(node->left) <= offset) {
+            // target inside left subtree
+            node = node->left;
+            if (!node) {
+                return nullptr;
+            }
+            pos -= avl_count(node->right) + 1;
+        } else {
+            // go to parent
+            AVLNode *parent = node->parent;
+            if (!parent) {
+                return nullptr;
+            }
+
+            if (parent->right == node) {
+                pos -= avl_count(node->left) + 1;
+            } else {
+                pos += avl_count(node->right) + 1;
+            }
+
+            node = parent;
+        }
+    }
+
+    return node;
+}
+
+/**
+ * Header-only helpers, the comparator is a template argument and gets
+ * inlined instead of called through a pointer
+ */
+
+/**
+ * Insert a fresh `node` (see `avl_init()`) ordered by
+ * `less(AVLNode *, AVLNode *)`, after the nodes equal to it
+ * Returns the new root
+ */
+template <typename Less>
+inline AVLNode *avl_insert(AVLNode *root, AVLNode *node, Less &&less) {
+    if (!root) {
+        return node;
+    }
+
+    AVLNode *curr = root;
+    while (true) {
+        AVLNode **from = less(node, curr) ? &curr->left : &curr->right;
+        if (!*from) {
+            *from = node;
+            node->parent = curr;
+            return avl_rebalance(node);
+        }
+        curr = *from;
+    }
+}
+
+/**
+ * The first node for which `below(AVLNode *)` is false, the nodes for which
+ * it is true coming first; NULL if none
+ */
+template <typename Below>
+inline AVLNode *avl_lower_bound(AVLNode *root, Below &&below) {
+    AVLNode *found = nullptr;
+    while (root) {
+        if (below(root)) {
+            root = root->right;
+        } else {
+            found = root;
+            root = root->left;
+        }
+    }
+    return found;
+}
+
 #endif /* AVL_H */
@@ -0,0 +1,118 @@
+/**
+ * Compare the key hash with the former byte-at-a-time FNV variant
+ * - speed: ns per key, by key length and on a mix of lengths close to what
+ *   the server sees (mostly short, `k123`-like and `user:<id>:<field>`-like
+ *   keys, a few long ones)
+ * - quality: how evenly sequential keys fill the buckets of a table sized
+ *   like the keyspace (the low bits) and the shards (the high bits)
+ */
+#include "hash.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// the function `str_hash()` used before
+static uint64_t str_hash_fnv(const uint8_t *data, size_t len) {
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash + data[i]) * 0x811C9DC5;
+    }
+    return hash;
+}
+
+static uint64_t str_hash_new(const uint8_t *data, size_t len) {
+    return str_hash(data, len);
+}
+
+static std::string make_key(std::mt19937_64 &rng, size_t i) {
+    uint32_t r = (uint32_t)(rng() % 100);
+    char buf[64];
+    if (r < 50) {
+        snprintf(buf, sizeof(buf), "k%zu", i);
+        return buf;
+    }
+    if (r < 90) {
+        snprintf(buf, sizeof(buf), "user:%08zu:session", i);
+        return buf;
+    }
+    // long keys: 32 to 256 bytes
+    std::string key = "cache:" + std::to_string(i) + ":";
+    key.resize(32 + rng() % 225, 'x');
+    return key;
+}
+
+static double bench(uint64_t (*h)(const uint8_t *, size_t),
+                    const std::vector<std::string> &keys, size_t rounds) {
+    uint64_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (const std::string &k : keys) {
+            sink += h((const uint8_t *)k.data(), k.size());
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    // keep the loop from being optimized away
+    if (sink == 42) {
+        printf(" ");
+    }
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    return ns / (double)(rounds * keys.size());
+}
+
+/**
+ * Largest bucket, relative to the average, of `keys` put into `nbuckets`
+ * by the low bits or the top byte of the hash
+ */
+static double max_load(uint64_t (*h)(const uint8_t *, size_t),
+                       const std::vector<std::string> &keys, size_t nbuckets,
+                       bool high) {
+    std::vector<uint32_t> count(nbuckets);
+    uint32_t worst = 0;
+    for (const std::string &k : keys) {
+        uint64_t v = h((const uint8_t *)k.data(), k.size());
+        size_t b = high ? (size_t)(v >> 56) % nbuckets : v & (nbuckets - 1);
+        worst = std::max(worst, ++count[b]);
+    }
+    return worst / ((double)keys.size() / (double)nbuckets);
+}
+
+int main() {
+    hash_seed_init();
+    std::mt19937_64 rng(1);
+
+    printf("%-12s %10s %10s\n", "key length", "fnv ns", "new ns");
+    for (size_t len : {4, 8, 16, 24, 32, 64, 128, 256, 1024}) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < 1024; ++i) {
+            std::string k(len, 'a');
+            for (char &c : k) {
+                c = (char)('a' + rng() % 26);
+            }
+            keys.push_back(k);
+        }
+        size_t rounds = 4000000 / (len + 16);
+        printf("%-12zu %10.2f %10.2f\n", len, bench(str_hash_fnv, keys, rounds),
+               bench(str_hash_new, keys, rounds));
+    }
+
+    std::vector<std::string> mix;
+    for (size_t i = 0; i < 100000; ++i) {
+        mix.push_back(make_key(rng, i));
+    }
+    printf("%-12s %10.2f %10.2f\n", "mix", bench(str_hash_fnv, mix, 50),
+           bench(str_hash_new, mix, 50));
+
+    // ideal is close to 1
+    printf("\nmax bucket load / average, %zu sequential keys\n", mix.size());
+    printf("%-12s %10s %10s\n", "buckets", "fnv", "new");
+    for (size_t n : {1024, 65536}) {
+        printf("%-12zu %10.2f %10.2f\n", n, max_load(str_hash_fnv, mix, n, false),
+               max_load(str_hash_new, mix, n, false));
+    }
+    printf("%-12s %10.2f %10.2f\n", "16 (high)", max_load(str_hash_fnv, mix, 16, true),
+           max_load(str_hash_new, mix, 16, true));
+    return 0;
+}
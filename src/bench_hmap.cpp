@@ -0,0 +1,182 @@
+/**
+ * Lookups through a comparator function pointer (`hm_lookup()`,
+ * `om_lookup()`, the C-style API) against the templated versions
+ * (`hm_find()`, `om_find()`) whose comparator is inlined, and against
+ * batches of `K_PREFETCH_BATCH` keys looked up at once (`hm_find_batch()`)
+ * - hits and misses, on a table that fits in the cache and on a large one
+ */
+#include "constants.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "omap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Item {
+    HNode node;
+    std::string key;
+    uint64_t val = 0;
+};
+
+struct Probe {
+    HNode node;
+    std::string_view key;
+};
+
+static bool item_eq(HNode *node, HNode *key) {
+    if (node->hcode != key->hcode) {
+        return false;
+    }
+    Item *item = container_of(node, Item, node);
+    Probe *probe = container_of(key, Probe, node);
+    return item->key == probe->key;
+}
+
+// keep the loops from being optimized away
+static volatile uint64_t g_sink;
+
+/**
+ * `find(i, n, out)` looks up the probes `i` to `i + n` at once, see
+ * `hm_find_batch()`
+ */
+template <typename F, typename V>
+static double bench_batch(size_t n, F &&find, V &&val) {
+    uint64_t sink = 0;
+    HNode *out[K_PREFETCH_BATCH];
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t base = 0; base < n; base += K_PREFETCH_BATCH) {
+        size_t batch = std::min(n - base, K_PREFETCH_BATCH);
+        find(base, batch, out);
+        for (size_t i = 0; i < batch; ++i) {
+            sink += val(out[i]);
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    g_sink = sink;
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() /
+           (double)n;
+}
+
+template <typename F> static double bench(size_t n, F &&f) {
+    uint64_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        sink += f(i);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    g_sink = sink;
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() /
+           (double)n;
+}
+
+static void bench_maps(size_t nkeys) {
+    std::vector<Item> items(nkeys);
+    HMap hmap;
+    OMap omap;
+    for (size_t i = 0; i < nkeys; ++i) {
+        items[i].key = "user:" + std::to_string(i) + ":session";
+        items[i].node.hcode =
+            str_hash((uint8_t *)items[i].key.data(), items[i].key.size());
+        items[i].val = i;
+    }
+    for (Item &item : items) {
+        hm_insert(&hmap, &item.node);
+    }
+    while (hmap.ht_from.table) {
+        hm_help_resizing(&hmap);
+    }
+    // the open-addressing table reads `hcode` only, `next` is left alone
+    std::vector<Item> oitems = items;
+    for (Item &item : oitems) {
+        om_insert(&omap, &item.node);
+    }
+    while (omap.ot_from.ctrl) {
+        (void)om_rehash_for(&omap, 1000);
+    }
+
+    // the same random hits and misses for every variant
+    std::mt19937_64 rng(1);
+    const size_t nprobes = 1 << 20;
+    std::vector<std::string> keys(nprobes);
+    std::vector<Probe> probes(nprobes);
+    for (size_t i = 0; i < nprobes; ++i) {
+        size_t k = rng() % nkeys;
+        bool miss = i % 4 == 0;
+        keys[i] = (miss ? "none:" : "user:") + std::to_string(k) + ":session";
+        probes[i].key = keys[i];
+        probes[i].node.hcode =
+            str_hash((uint8_t *)keys[i].data(), keys[i].size());
+    }
+
+    auto val = [](HNode *node) -> uint64_t {
+        return node ? container_of(node, Item, node)->val : 1;
+    };
+    std::vector<uint64_t> hcodes(nprobes);
+    for (size_t i = 0; i < nprobes; ++i) {
+        hcodes[i] = probes[i].node.hcode;
+    }
+    // the comparator of a batch starting at the probe `base`
+    auto eq_at = [&](size_t base) {
+        return [&probes, base](size_t i, HNode *node) {
+            return container_of(node, Item, node)->key == probes[base + i].key;
+        };
+    };
+    // best of a few alternating rounds, the large tables are noisy
+    double hp = 1e9, ht = 1e9, hb = 1e9, op = 1e9, ot = 1e9, ob = 1e9;
+    for (int round = 0; round < 3; ++round) {
+        hp = std::min(hp, bench(nprobes, [&](size_t i) {
+            return val(hm_lookup(&hmap, &probes[i].node, &item_eq));
+        }));
+        ht = std::min(ht, bench(nprobes, [&](size_t i) {
+            Probe &p = probes[i];
+            return val(hm_find(&hmap, p.node.hcode, [&](HNode *node) {
+                return container_of(node, Item, node)->key == p.key;
+            }));
+        }));
+        hb = std::min(hb, bench_batch(
+                              nprobes,
+                              [&](size_t base, size_t batch, HNode **out) {
+                                  hm_find_batch(&hmap, &hcodes[base], batch,
+                                                eq_at(base), out);
+                              },
+                              val));
+        op = std::min(op, bench(nprobes, [&](size_t i) {
+            return val(om_lookup(&omap, &probes[i].node, &item_eq));
+        }));
+        ot = std::min(ot, bench(nprobes, [&](size_t i) {
+            Probe &p = probes[i];
+            return val(om_find(&omap, p.node.hcode, [&](HNode *node) {
+                return container_of(node, Item, node)->key == p.key;
+            }));
+        }));
+        ob = std::min(ob, bench_batch(
+                              nprobes,
+                              [&](size_t base, size_t batch, HNode **out) {
+                                  om_find_batch(&omap, &hcodes[base], batch,
+                                                eq_at(base), out);
+                              },
+                              val));
+    }
+    printf("%-10zu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", nkeys, hp,
+           ht, hb, op, ot, ob);
+    hm_destroy(&hmap);
+    om_destroy(&omap);
+}
+
+int main() {
+    hash_seed_init();
+
+    printf("ns per lookup, 1 in 4 is a miss\n");
+    printf("%-10s %10s %10s %10s %10s %10s %10s\n", "keys", "hm ptr",
+           "hm inline", "hm batch", "om ptr", "om inline", "om batch");
+    for (size_t n : {1000, 100000, 2000000}) {
+        bench_maps(n);
+    }
+    return 0;
+}
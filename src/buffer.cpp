@@ -0,0 +1,98 @@
+#include "buffer.h"
+#include "constants.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// size classes: K_BUF_MIN << i, only the small ones are pooled
+const size_t K_BUF_CLASSES = 8;
+
+struct BufPool {
+    std::vector<uint8_t *> free[K_BUF_CLASSES];
+    size_t bytes = 0;     // bytes held by the free lists
+    size_t allocated = 0; // bytes of all the blocks, `buf_allocated()`
+};
+
+// connections are only touched by the thread owning them
+static thread_local BufPool pool;
+
+static size_t buf_class(size_t cap) {
+    size_t i = 0;
+    while (i < K_BUF_CLASSES && (K_BUF_MIN << i) != cap) {
+        i++;
+    }
+    return i; // K_BUF_CLASSES if not pooled
+}
+
+static uint8_t *pool_get(size_t cap) {
+    size_t i = buf_class(cap);
+    if (i < K_BUF_CLASSES && !pool.free[i].empty()) {
+        uint8_t *ptr = pool.free[i].back();
+        pool.free[i].pop_back();
+        pool.bytes -= cap;
+        return ptr;
+    }
+
+    uint8_t *ptr = (uint8_t *)malloc(cap);
+    assert(ptr);
+    pool.allocated += cap;
+    return ptr;
+}
+
+static void pool_put(uint8_t *ptr, size_t cap) {
+    size_t i = buf_class(cap);
+    if (i < K_BUF_CLASSES && pool.bytes + cap <= K_BUF_POOL_BYTES) {
+        pool.free[i].push_back(ptr);
+        pool.bytes += cap;
+    } else {
+        free(ptr);
+        pool.allocated -= cap;
+    }
+}
+
+void buf_reserve(Buffer *buf, size_t cap) {
+    if (cap <= buf->cap) {
+        return;
+    }
+
+    size_t new_cap = buf->cap ? buf->cap : K_BUF_MIN;
+    while (new_cap < cap) {
+        new_cap *= 2;
+    }
+
+    uint8_t *data = pool_get(new_cap);
+    if (buf->data) {
+        memcpy(data, buf->data, buf->size);
+        pool_put(buf->data, buf->cap);
+    }
+    buf->data = data;
+    buf->cap = new_cap;
+}
+
+void buf_append(Buffer *buf, const void *data, size_t len) {
+    buf_reserve(buf, buf->size + len);
+    memcpy(&buf->data[buf->size], data, len);
+    buf->size += len;
+}
+
+void buf_consume(Buffer *buf, size_t n) {
+    assert(n <= buf->size);
+    size_t remaining = buf->size - n;
+    if (remaining) {
+        memmove(buf->data, &buf->data[n], remaining);
+    }
+    buf->size = remaining;
+}
+
+void buf_release(Buffer *buf) {
+    assert(buf->size == 0);
+    if (buf->data) {
+        pool_put(buf->data, buf->cap);
+    }
+    *buf = Buffer{};
+}
+
+size_t buf_allocated() { return pool.allocated; }
@@ -0,0 +1,39 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Growable byte buffer for connection I/O
+ * The memory comes from a per-thread pool of power-of-2 sized blocks, and is
+ * given back to the pool when the buffer is empty, so idle connections do
+ * not hold any buffer memory
+ */
+struct Buffer {
+    uint8_t *data = nullptr;
+    size_t size = 0; // bytes in use
+    size_t cap = 0;
+};
+
+/**
+ * Make room for at least `cap` bytes in total, keeping the content
+ */
+void buf_reserve(Buffer *buf, size_t cap);
+
+void buf_append(Buffer *buf, const void *data, size_t len);
+
+/**
+ * Remove `n` bytes from the front
+ */
+void buf_consume(Buffer *buf, size_t n);
+
+/**
+ * Give the memory back to the pool, the buffer must be empty
+ */
+void buf_release(Buffer *buf);
+
+// bytes of the blocks of the calling thread, in use or in its pool
+size_t buf_allocated();
+
+#endif /* BUFFER_H */
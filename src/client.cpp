@@ -1,4 +1,5 @@
 #include "constants.h"
+#include "shm.h"
 #include "utils.h"
 #include <cerrno>
 #include <cstddef>
@@ -9,27 +10,76 @@
 #include <netinet/in.h>
 #include <string>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
+/**
+ * A TCP or Unix socket, or the rings of the shared-memory transport
+ */
+struct Transport {
+    int fd = -1;
+    ShmChan *shm = nullptr;
+};
+
+static int32_t tr_write_all(Transport &tr, const char *buf, size_t n) {
+    if (!tr.shm) {
+        return write_all(tr.fd, buf, n);
+    }
+    while (n > 0) {
+        ssize_t rv = shm_chan_write(tr.shm, buf, n);
+        if (rv < 0 && errno == EAGAIN) {
+            shm_chan_wait(tr.shm); // the ring is full
+            continue;
+        }
+        if (rv < 0) {
+            return -1;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    return 0;
+}
+
+static int32_t tr_read_full(Transport &tr, char *buf, size_t n) {
+    if (!tr.shm) {
+        return read_full(tr.fd, buf, n);
+    }
+    while (n > 0) {
+        ssize_t rv = shm_chan_read(tr.shm, buf, n);
+        if (rv < 0 && errno == EAGAIN) {
+            shm_chan_wait(tr.shm); // the ring is empty
+            continue;
+        }
+        if (rv <= 0) {
+            errno = 0;
+            return -1; // EOF
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    return 0;
+}
+
 static int32_t query(int fd, const char *text) {
     uint32_t len = (uint32_t)strlen(text);
     if (len > K_MAX_MSG) {
         return -1;
     }
 
-    char write_buf[4 + K_MAX_MSG]{};
-    memcpy(write_buf, &len, 4);
+    std::vector<char> write_buf(4 + len);
+    memcpy(write_buf.data(), &len, 4);
     memcpy(&write_buf[4], text, len);
 
-    if (int32_t err = write_all(fd, write_buf, 4 + len)) {
+    if (int32_t err = write_all(fd, write_buf.data(), 4 + len)) {
         return err;
     }
 
     // 4 bytes header
-    char read_buf[4 + K_MAX_MSG + 1];
+    std::vector<char> read_buf(4);
     errno = 0;
-    int32_t err = read_full(fd, read_buf, 4);
+    int32_t err = read_full(fd, read_buf.data(), 4);
 
     if (err) {
         if (errno == 0) {
@@ -40,13 +90,14 @@ static int32_t query(int fd, const char *text) {
         return err;
     }
 
-    memcpy(&len, read_buf, 4);
+    memcpy(&len, read_buf.data(), 4);
     if (len > K_MAX_MSG) {
         msg("too long");
         return -1;
     }
 
     // reply body
+    read_buf.resize(4 + len + 1);
     err = read_full(fd, &read_buf[4], len);
     if (err) {
         msg("read() error");
@@ -59,7 +110,7 @@ static int32_t query(int fd, const char *text) {
     return 0;
 }
 
-static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
+static int32_t send_req(Transport &tr, const std::vector<std::string> &cmd) {
     uint32_t len = 4; // length of nstr itself, 4 bytes
     for (const std::string &s : cmd) {
         len += 4 + s.size(); // length of cmd + cmd itself
@@ -69,8 +120,8 @@ static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
         return -1;
     }
 
-    char wbuf[4 + K_MAX_MSG]{}; // length of the entire write buffer
-    memcpy(&wbuf[0], &len, 4);  // nstr + all cmds
+    std::vector<char> wbuf(4 + len); // length of the entire write buffer
+    memcpy(&wbuf[0], &len, 4);       // nstr + all cmds
     uint32_t n = cmd.size();    // number of commands in the cmd vector
     memcpy(&wbuf[4], &n, 4);
     size_t curr_pos = 8;
@@ -82,7 +133,7 @@ static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
         curr_pos += 4 + s.size();
     }
 
-    return write_all(fd, wbuf, 4 + len);
+    return tr_write_all(tr, wbuf.data(), 4 + len);
 }
 
 static int32_t on_response(const uint8_t *data, size_t size) {
@@ -179,11 +230,14 @@ static int32_t on_response(const uint8_t *data, size_t size) {
     }
 }
 
-static int32_t read_res(int fd) {
+/**
+ * Read one response, and print it unless `quiet`
+ */
+static int32_t read_res(Transport &tr, bool quiet) {
     // 4 bytes header
-    char read_buf[4 + K_MAX_MSG + 1];
+    std::vector<char> read_buf(4);
     errno = 0;
-    int32_t err = read_full(fd, read_buf, 4);
+    int32_t err = tr_read_full(tr, read_buf.data(), 4);
 
     if (err) {
         if (errno == 0) {
@@ -195,19 +249,23 @@ static int32_t read_res(int fd) {
     }
 
     uint32_t len{};
-    memcpy(&len, read_buf, 4);
+    memcpy(&len, read_buf.data(), 4);
     if (len > K_MAX_MSG) {
         msg("too long");
         return -1;
     }
 
     // reply body
-    err = read_full(fd, &read_buf[4], len);
+    read_buf.resize(4 + len + 1);
+    err = tr_read_full(tr, &read_buf[4], len);
     if (err) {
         msg("read() error");
         return err;
     }
 
+    if (quiet) {
+        return 0;
+    }
     int32_t rv = on_response((uint8_t *)&read_buf[4], len);
     if (rv > 0 && (uint32_t)rv != len) {
         msg("bad response");
@@ -216,7 +274,7 @@ static int32_t read_res(int fd) {
     return rv;
 }
 
-int main(int argc, char **argv) {
+static int connect_tcp() {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         die("socket()");
@@ -232,22 +290,94 @@ int main(int argc, char **argv) {
     if (rv) {
         die("connect");
     }
+    return fd;
+}
+
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        msg("socket path too long");
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("connect");
+    }
+    return fd;
+}
+
+static uint64_t get_monotonic_usec() {
+    timespec tv{0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+}
+
+/**
+ * usage: client [--unix PATH | --shm PATH] [--repeat N] <cmd> <args>...
+ * - `--unix` and `--shm` connect to the matching server listener
+ * - `--repeat` sends the command N times, one round trip at a time, prints
+ *   the last response and the average latency, to compare the transports
+ */
+int main(int argc, char **argv) {
+    const char *unix_path = nullptr;
+    const char *shm_path = nullptr;
+    uint32_t repeat = 1;
+    int i = 1;
+    for (; i + 1 < argc && 0 == strncmp(argv[i], "--", 2); i += 2) {
+        if (0 == strcmp(argv[i], "--unix")) {
+            unix_path = argv[i + 1];
+        } else if (0 == strcmp(argv[i], "--shm")) {
+            shm_path = argv[i + 1];
+        } else if (0 == strcmp(argv[i], "--repeat")) {
+            repeat = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+            repeat = repeat ? repeat : 1;
+        } else {
+            break;
+        }
+    }
+
+    Transport tr;
+    ShmChan chan;
+    if (shm_path) {
+        // the socket only carries the handshake
+        int sock = connect_unix(shm_path);
+        int err = shm_chan_recv_fds(&chan, sock);
+        close(sock);
+        if (err) {
+            fprintf(stderr, "shm handshake: %s\n", strerror(-err));
+            return 1;
+        }
+        tr.shm = &chan;
+    } else {
+        tr.fd = unix_path ? connect_unix(unix_path) : connect_tcp();
+    }
 
     std::vector<std::string> cmd{};
-    for (int i = 1; i < argc; ++i) {
+    for (; i < argc; ++i) {
         cmd.push_back(argv[i]);
     }
-    int32_t err = send_req(fd, cmd);
-    if (err) {
-        close(fd);
-        return 0;
+
+    uint64_t start_us = get_monotonic_usec();
+    for (uint32_t n = 1; n <= repeat; ++n) {
+        if (send_req(tr, cmd) || read_res(tr, n < repeat)) {
+            break;
+        }
     }
-    err = read_res(fd);
-    if (err) {
-        close(fd);
-        return 0;
+    if (repeat > 1) {
+        fprintf(stderr, "%u round trips, avg %.2f us\n", repeat,
+                (double)(get_monotonic_usec() - start_us) / repeat);
     }
 
-    close(fd);
+    if (tr.shm) {
+        shm_chan_close(tr.shm);
+    } else {
+        close(tr.fd);
+    }
     return 0;
 }
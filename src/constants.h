@@ -2,12 +2,36 @@
 #define CONSTANTS_H
 
 #include <cstddef>
+#include <cstdint>
 
-const size_t K_MAX_MSG = 4096;
+const size_t K_MAX_MSG = 32 << 20; // default of `--max-msg`
 const size_t K_MAX_ARGS = 1024;
-const size_t K_RESIZING_WORK = 128;
+const size_t K_BUF_MIN = 1024;          // initial capacity of conn buffers
+const size_t K_BUF_POOL_BYTES = 4 << 20; // free buffers kept per thread
+// pipelined responses are flushed once they reach this size
+const size_t K_WBUF_BATCH = 64 << 10;
+const size_t K_RESIZING_WORK = 128; // nodes migrated per operation
+const size_t K_RESIZING_VISITS = 8 * K_RESIZING_WORK; // buckets visited
 const size_t K_MAX_LOAD_FACTOR = 8;
+const size_t K_SHRINK_RATIO = 8; // buckets per node that trigger a shrink
+const size_t K_HT_MIN_SLOTS = 4;
+const size_t K_PREFETCH_BATCH = 16; // keys in flight, multi-key lookups
+const size_t K_INLINE_VAL_MAX = 64; // longest value stored inside its entry
+const uint64_t K_IDLE_REHASH_US = 1000; // migration per idle loop tick
+const uint32_t K_REHASH_TICK_MS = 10;   // loop tick while a resize is ongoing
 const size_t K_IDLE_TIMEOUT_MS = 5 * 1000;
+const size_t K_MAX_EVENTS = 1024; // ready fds returned by one epoll_wait()
+const unsigned K_URING_ENTRIES = 4096; // size of the io_uring SQ
+const size_t K_ACCEPT_BATCH = 256;     // connections accepted per iteration
+const size_t K_SHM_RING_SIZE = 1 << 20; // per direction, `--shm` transport
+const uint32_t K_MAX_CLIENTS = 10000;  // default of `--max-clients`
+const size_t K_EVICT_SAMPLES = 5;    // keys sampled per eviction
+const size_t K_EVICT_POOL = 16;      // best candidates kept across them
+const size_t K_EVICT_WORK = 1000;    // keys evicted per loop iteration
+const uint32_t K_LRU_CLOCK_MS = 10;  // resolution of `Entry::atime`
+const uint32_t K_LFU_DECAY_MS = 60 * 1000; // idle time taking 1 off `lfu`
+const uint8_t K_LFU_INIT = 5;        // `lfu` of a new key
+const uint32_t K_LFU_LOG_FACTOR = 10;
 
 enum {
     SER_NIL = 0, // NULL
@@ -23,6 +47,8 @@ enum {
     ERR_2BIG = 2,
     ERR_TYPE = 3,
     ERR_ARG = 4,
+    ERR_MAXCLIENTS = 5,
+    ERR_OOM = 6,
 };
 
 #endif /* CONSTANTS_H */
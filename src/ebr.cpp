@@ -0,0 +1,134 @@
+#include "ebr.h"
+#include "slab.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// `ebr_collect()` is forced once this many items are waiting
+const size_t K_EBR_BATCH = 1024;
+
+// 0 when not reading, else `(epoch << 1) | 1`
+struct alignas(64) EbrSlot {
+    std::atomic<uint64_t> state{0};
+};
+
+struct EbrItem {
+    uint64_t epoch = 0;
+    void (*f)(void *) = nullptr; // NULL: `slab_free(ptr, size)`
+    void *ptr = nullptr;
+    size_t size = 0;
+    size_t bytes = 0; // counted in `g_retired_bytes`
+};
+
+static std::atomic<size_t> g_retired_bytes{0};
+
+static void ebr_item_free(const EbrItem &item) {
+    if (item.bytes) {
+        g_retired_bytes.fetch_sub(item.bytes, std::memory_order_relaxed);
+    }
+    if (item.f) {
+        item.f(item.ptr);
+    } else {
+        slab_free(item.ptr, item.size);
+    }
+}
+
+static std::atomic<uint64_t> g_epoch{1};
+static EbrSlot *g_slots = nullptr;
+static uint32_t g_nslots = 0;
+
+static thread_local EbrSlot *t_slot = nullptr;
+static thread_local std::vector<EbrItem> t_limbo;
+
+void ebr_init(uint32_t nthreads) {
+    g_slots = new EbrSlot[nthreads];
+    g_nslots = nthreads;
+}
+
+bool ebr_enabled() { return g_slots != nullptr; }
+
+void ebr_thread(uint32_t idx) {
+    if (g_slots) {
+        assert(idx < g_nslots);
+        t_slot = &g_slots[idx];
+    }
+}
+
+void ebr_enter() {
+    if (!t_slot) {
+        return;
+    }
+    uint64_t epoch = g_epoch.load(std::memory_order_relaxed);
+    // seq_cst: the announce is visible before any of the reads that follow
+    t_slot->state.store((epoch << 1) | 1, std::memory_order_seq_cst);
+}
+
+void ebr_exit() {
+    if (t_slot) {
+        t_slot->state.store(0, std::memory_order_release);
+    }
+}
+
+static void ebr_push(const EbrItem &item) {
+    if (!t_slot) {
+        ebr_item_free(EbrItem{0, item.f, item.ptr, item.size, 0});
+        return;
+    }
+    g_retired_bytes.fetch_add(item.bytes, std::memory_order_relaxed);
+    t_limbo.push_back(item);
+    t_limbo.back().epoch = g_epoch.load(std::memory_order_seq_cst);
+    if (t_limbo.size() >= K_EBR_BATCH) {
+        ebr_collect();
+    }
+}
+
+void ebr_retire(void *ptr, void (*f)(void *), size_t bytes) {
+    ebr_push(EbrItem{0, f, ptr, 0, bytes});
+}
+
+/**
+ * The epoch can move on if no reader is still in an older one
+ */
+static void ebr_advance() {
+    uint64_t epoch = g_epoch.load(std::memory_order_seq_cst);
+    for (uint32_t i = 0; i < g_nslots; ++i) {
+        uint64_t state = g_slots[i].state.load(std::memory_order_seq_cst);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return;
+        }
+    }
+    g_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+void ebr_collect() {
+    if (!t_slot || t_limbo.empty()) {
+        return;
+    }
+    ebr_advance();
+
+    // a reader inside since epoch `e` may hold what was retired during `e`
+    // or `e - 1`, not older
+    uint64_t epoch = g_epoch.load(std::memory_order_seq_cst);
+    // a callback may retire more, into the emptied list
+    std::vector<EbrItem> items;
+    items.swap(t_limbo);
+    for (const EbrItem &item : items) {
+        if (item.epoch + 2 <= epoch) {
+            ebr_item_free(item);
+        } else {
+            t_limbo.push_back(item);
+        }
+    }
+}
+
+size_t ebr_pending() { return t_limbo.size(); }
+
+size_t ebr_retired_bytes() {
+    return g_retired_bytes.load(std::memory_order_relaxed);
+}
+
+void ebr_free(void *ptr, size_t size) {
+    ebr_push(EbrItem{0, nullptr, ptr, size, slab_size(size)});
+}
@@ -0,0 +1,42 @@
+#ifndef EBR_H
+#define EBR_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Epoch-based reclamation, for the memory that reactors read without a lock
+ * (`--shared-reads`)
+ * - a reader announces the global epoch in its slot for the duration of a
+ *   read (`ebr_enter()` / `ebr_exit()`)
+ * - a writer retires what it unlinked, tagged with the epoch of the time
+ * - the epoch moves on once every reader inside a read has seen the current
+ *   one; what was retired 2 epochs ago can no longer be reached by anyone
+ * Each thread collects its own retired memory, the callbacks run on it
+ * Before `ebr_init()`, `ebr_retire()` calls the callback right away
+ */
+void ebr_init(uint32_t nthreads);
+bool ebr_enabled();
+
+// the slot of the calling thread, once before anything else on it
+void ebr_thread(uint32_t idx);
+
+void ebr_enter();
+void ebr_exit();
+
+// `bytes`: what `f` will free, for `ebr_retired_bytes()`
+void ebr_retire(void *ptr, void (*f)(void *), size_t bytes = 0);
+
+// free what can be freed, and try to advance the epoch
+void ebr_collect();
+
+// retired by this thread and not freed yet
+size_t ebr_pending();
+
+// the `bytes` of what all the threads retired and did not free yet
+size_t ebr_retired_bytes();
+
+// `ebr_retire()` of `slab_alloc()` memory, `slab_free(ptr, size)` later
+void ebr_free(void *ptr, size_t size);
+
+#endif /* EBR_H */
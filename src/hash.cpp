@@ -0,0 +1,20 @@
+#include "hash.h"
+#include <cstdint>
+#include <ctime>
+#include <sys/random.h>
+#include <unistd.h>
+
+uint64_t g_hash_seed = K_HASH_P0;
+
+void hash_seed_init(uint64_t seed) {
+    if (!seed && getrandom(&seed, sizeof(seed), GRND_NONBLOCK) !=
+                     (ssize_t)sizeof(seed)) {
+        // the entropy pool is not ready this early in the boot
+        timespec ts{};
+        clock_gettime(CLOCK_REALTIME, &ts);
+        seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^
+               ((uint64_t)getpid() << 16);
+    }
+    // spread a weak seed over all the bits
+    g_hash_seed = seed ^ hash_mix(seed ^ K_HASH_P0, K_HASH_P1);
+}
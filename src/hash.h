@@ -0,0 +1,99 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * 64-bit key hash for the keyspace and the sorted sets
+ * - reads 8 bytes at a time, short keys take two overlapping loads and no
+ *   loop at all; each step is one 64x64->128-bit multiply folded in half
+ *   (the "mum" mix of wyhash)
+ * - keyed with a random per-process seed, so the bucket of a key cannot be
+ *   predicted from outside and the tables cannot be flooded with crafted keys
+ * - every bit of the result is usable: the tables take the low bits, the
+ *   shards the high ones
+ */
+
+// set once by `hash_seed_init()`, before any thread starts
+extern uint64_t g_hash_seed;
+
+/**
+ * Draw the seed from the kernel, or use `seed` if it is non-zero
+ * (reproducible runs)
+ */
+void hash_seed_init(uint64_t seed = 0);
+
+const uint64_t K_HASH_P0 = 0xA0761D6478BD642Full;
+const uint64_t K_HASH_P1 = 0xE7037ED1A0B428DBull;
+const uint64_t K_HASH_P2 = 0x8EBC6AF09C88C6E3ull;
+const uint64_t K_HASH_P3 = 0x589965CC75374CC3ull;
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// unaligned little-endian loads, `memcpy` compiles to a single `mov`
+static inline uint64_t hash_r64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t hash_r32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t str_hash_seeded(const uint8_t *p, size_t len,
+                                       uint64_t seed) {
+    uint64_t a = 0, b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping words cover 4..16 bytes
+            size_t mid = (len >> 3) << 2;
+            a = (hash_r32(p) << 32) | hash_r32(p + mid);
+            b = (hash_r32(p + len - 4) << 32) | hash_r32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) |
+                p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // 3 independent lanes keep the multipliers busy
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = hash_mix(hash_r64(p) ^ K_HASH_P1, hash_r64(p + 8) ^ seed);
+                s1 = hash_mix(hash_r64(p + 16) ^ K_HASH_P2,
+                              hash_r64(p + 24) ^ s1);
+                s2 = hash_mix(hash_r64(p + 32) ^ K_HASH_P3,
+                              hash_r64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_r64(p) ^ K_HASH_P1, hash_r64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, possibly overlapping the previous block
+        a = hash_r64(p + i - 16);
+        b = hash_r64(p + i - 8);
+    }
+
+    __uint128_t r = (__uint128_t)(a ^ K_HASH_P1) * (b ^ seed);
+    return hash_mix((uint64_t)r ^ K_HASH_P0 ^ len,
+                    (uint64_t)(r >> 64) ^ K_HASH_P1);
+}
+
+static inline uint64_t str_hash(const uint8_t *data, size_t len) {
+    return str_hash_seeded(data, len, g_hash_seed);
+}
+
+#endif /* HASH_H */
@@ -1,18 +1,37 @@
 #include "hashtable.h"
 #include "constants.h"
+#include "ebr.h"
+#include "slab.h"
 #include "utils.h"
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <string>
+#include <time.h>
+
+/**
+ * `*dst = src`, `table` and `mask` are read by `h_find_shared()` meanwhile
+ */
+static void h_assign(HTable *dst, const HTable &src) {
+    __atomic_store_n(&dst->table, src.table, __ATOMIC_RELEASE);
+    __atomic_store_n(&dst->mask, src.mask, __ATOMIC_RELAXED);
+    dst->size = src.size;
+}
 
 void h_init(HTable *htable, size_t n) {
     assert(n > 0 && ((n - 1) & n) == 0); // make sure n is power of 2
-    htable->table =
-        (HNode **)calloc(sizeof(HNode *), n); // array of pointers to HNode
-    htable->mask = n - 1;
-    htable->size = 0;
+    HTable fresh;
+    // array of pointers to HNode, the small ones from the slabs
+    fresh.table = (HNode **)slab_calloc(n * sizeof(HNode *));
+    fresh.mask = n - 1;
+    h_assign(htable, fresh);
+}
+
+static void h_free(HTable *htable) {
+    if (htable->table) {
+        slab_free(htable->table, (htable->mask + 1) * sizeof(HNode *));
+    }
 }
 
 /**
@@ -21,31 +40,21 @@ void h_init(HTable *htable, size_t n) {
 void h_insert(HTable *htable, HNode *node) {
     size_t pos = node->hcode & htable->mask;
     HNode *next = htable->table[pos];
-    node->next = next;
-    htable->table[pos] = node;
+    __atomic_store_n(&node->next, next, __ATOMIC_RELAXED);
+    // published once complete, see `h_find_shared()`
+    __atomic_store_n(&htable->table[pos], node, __ATOMIC_RELEASE);
     htable->size++;
 }
 
 HNode **h_lookup(HTable *htable, HNode *key, bool (*cmp)(HNode *, HNode *)) {
-    if (!htable->table) {
-        return NULL;
-    }
-
-    size_t pos = key->hcode & htable->mask;
-    HNode **from = &htable->table[pos]; // list of the Nodes on this linked list
-    while (*from) {
-        if (cmp(*from, key)) {
-            return from;
-        }
-        from = &(*from)->next;
-    }
-
-    return NULL;
+    return h_find(htable, key->hcode,
+                  [&](HNode *node) { return cmp(node, key); });
 }
 
 HNode *h_detach(HTable *htable, HNode **from) {
     HNode *node = *from;
-    *from = (*from)->next;
+    // `node->next` is left as is for a reader standing on `node`
+    __atomic_store_n(from, node->next, __ATOMIC_RELEASE);
     htable->size--;
     return node;
 }
@@ -64,52 +73,151 @@ void h_scan(HTable *table, void (*f)(HNode *, void *), void *arg) {
     }
 }
 
+static uint64_t rev_bits(uint64_t v) {
+    v = __builtin_bswap64(v);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    return v;
+}
+
+// increment the bits of `mask`, starting from the highest one
+static uint64_t cursor_next(uint64_t v, size_t mask) {
+    v |= ~(uint64_t)mask;
+    return rev_bits(rev_bits(v) + 1);
+}
+
+uint64_t h_cursor_step(uint64_t cursor, size_t mask0, size_t mask1, bool two,
+                       void (*bucket)(int t, size_t idx, void *ctx),
+                       void *ctx) {
+    uint64_t v = cursor;
+    if (!two) {
+        bucket(0, v & mask0, ctx);
+        return cursor_next(v, mask0);
+    }
+
+    // `small` is the table with fewer buckets
+    int small = mask0 <= mask1 ? 0 : 1;
+    size_t m0 = small == 0 ? mask0 : mask1;
+    size_t m1 = small == 0 ? mask1 : mask0;
+    bucket(small, v & m0, ctx);
+    // the buckets of the larger table that expand the one above
+    do {
+        bucket(1 - small, v & m1, ctx);
+        v = cursor_next(v, m1);
+    } while (v & (m0 ^ m1));
+    return v;
+}
+
 size_t hm_size(HMap *hmap) { return hmap->ht_to.size + hmap->ht_from.size; }
 
-void hm_help_resizing(HMap *hmap) {
-    if (hmap->ht_from.table == NULL) {
+uint64_t h_now_usec() {
+    timespec tv{0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_nsec / 1000;
+}
+
+void h_resize_begin(HResizeStats *stats) { stats->start_us = h_now_usec(); }
+
+void h_resize_end(HResizeStats *stats) {
+    uint64_t usec = h_now_usec() - stats->start_us;
+    stats->count++;
+    stats->last_usec = usec;
+    stats->max_usec = usec > stats->max_usec ? usec : stats->max_usec;
+}
+
+size_t hm_slots(HMap *hmap) {
+    size_t n = hmap->ht_to.table ? hmap->ht_to.mask + 1 : 0;
+    return n + (hmap->ht_from.table ? hmap->ht_from.mask + 1 : 0);
+}
+
+/**
+ * Move at most `nodes` nodes, visiting at most `K_RESIZING_VISITS` buckets
+ * per `K_RESIZING_WORK` nodes; `resizing_pos` is the next bucket to visit
+ */
+static void hm_migrate(HMap *hmap, size_t nodes) {
+    HTable *from = &hmap->ht_from;
+    if (from->table == NULL) {
         return;
     }
 
-    size_t work_done = 0;
-    while (work_done < K_RESIZING_WORK && hmap->ht_from.size > 0) {
-        HNode **from = &hmap->ht_from.table[hmap->resizing_pos];
-        if (!*from) {
-            // bucket empty
+    h_seq_begin(&hmap->seq);
+    size_t visits = nodes * (K_RESIZING_VISITS / K_RESIZING_WORK);
+    size_t nslots = from->mask + 1;
+    while (nodes > 0 && from->size > 0 && hmap->resizing_pos < nslots) {
+        HNode **bucket = &from->table[hmap->resizing_pos];
+        if (!*bucket) {
+            hmap->resizing_pos++;
+            if (--visits == 0) {
+                break;
+            }
             continue;
         }
 
-        h_insert(&hmap->ht_to, h_detach(&hmap->ht_from, from));
-        work_done++;
+        h_insert(&hmap->ht_to, h_detach(from, bucket));
+        nodes--;
     }
 
-    if (hmap->ht_from.size == 0) {
-        // resizing finished
-        free(hmap->ht_from.table);
-        hmap->ht_from = HTable{};
+    if (from->size == 0) {
+        // resizing finished, a reader may still hold the array
+        ebr_free(from->table, (from->mask + 1) * sizeof(HNode *));
+        h_assign(from, HTable{});
+        h_resize_end(&hmap->resizes);
     }
+    h_seq_end(&hmap->seq);
 }
 
-HNode *hm_lookup(HMap *hmap, HNode *key, bool (*cmp)(HNode *, HNode *)) {
-    hm_help_resizing(hmap);
-    HNode **from = h_lookup(&hmap->ht_to, key, cmp);
-    if (!from) {
-        from = h_lookup(&hmap->ht_from, key, cmp);
+void hm_help_resizing(HMap *hmap) { hm_migrate(hmap, K_RESIZING_WORK); }
+
+bool hm_rehash_for(HMap *hmap, uint64_t usec) {
+    uint64_t deadline = h_now_usec() + usec;
+    while (hmap->ht_from.table) {
+        hm_migrate(hmap, 8 * K_RESIZING_WORK);
+        if (h_now_usec() >= deadline) {
+            break;
+        }
     }
-    return from ? *from : NULL;
+    return hmap->ht_from.table != NULL;
+}
+
+HNode *hm_lookup(HMap *hmap, HNode *key, bool (*cmp)(HNode *, HNode *)) {
+    return hm_find(hmap, key->hcode,
+                   [&](HNode *node) { return cmp(node, key); });
 }
 
-void hm_start_resizing(HMap *hmap) {
+void hm_start_resizing(HMap *hmap, size_t n) {
     assert(hmap->ht_from.table == NULL);
-    // create a bigger hashtable and swap them
-    hmap->ht_from = hmap->ht_to;
-    h_init(&hmap->ht_to, (hmap->ht_to.mask + 1) * 2);
+    // create the new hashtable and swap them
+    h_seq_begin(&hmap->seq);
+    h_assign(&hmap->ht_from, hmap->ht_to);
+    h_init(&hmap->ht_to, n);
+    h_seq_end(&hmap->seq);
     hmap->resizing_pos = 0;
+    h_resize_begin(&hmap->resizes);
+}
+
+/**
+ * Back to a load factor of about 1 once the buckets outnumber the nodes
+ * `K_SHRINK_RATIO` times; growing again takes `K_MAX_LOAD_FACTOR` times more
+ * nodes, so a workload around the threshold does not keep resizing
+ */
+void hm_check_shrink(HMap *hmap) {
+    HTable *to = &hmap->ht_to;
+    if (hmap->ht_from.table || !to->table || to->mask + 1 <= K_HT_MIN_SLOTS ||
+        to->size * K_SHRINK_RATIO >= to->mask + 1) {
+        return;
+    }
+
+    size_t n = K_HT_MIN_SLOTS;
+    while (n < to->size) {
+        n *= 2;
+    }
+    hm_start_resizing(hmap, n);
 }
 
 void hm_insert(HMap *hmap, HNode *node) {
     if (!hmap->ht_to.table) {
-        h_init(&hmap->ht_to, 4);
+        h_init(&hmap->ht_to, K_HT_MIN_SLOTS);
     }
     h_insert(&hmap->ht_to, node);
 
@@ -117,29 +225,60 @@ void hm_insert(HMap *hmap, HNode *node) {
         // why resizing here?
         size_t load_factor = hmap->ht_to.size / (hmap->ht_to.mask + 1);
         if (load_factor >= K_MAX_LOAD_FACTOR) {
-            hm_start_resizing(hmap);
+            hm_start_resizing(hmap, (hmap->ht_to.mask + 1) * 2);
         }
     }
     hm_help_resizing(hmap);
 }
 
 HNode *hm_pop(HMap *hmap, HNode *key, bool (*cmp)(HNode *, HNode *)) {
-    hm_help_resizing(hmap);
+    return hm_take(hmap, key->hcode,
+                   [&](HNode *node) { return cmp(node, key); });
+}
+
+void hm_replace(HMap *hmap, HNode *old, HNode *node) {
+    auto same = [&](HNode *curr) { return curr == old; };
+    HNode **from = h_find(&hmap->ht_to, old->hcode, same);
+    if (!from) {
+        from = h_find(&hmap->ht_from, old->hcode, same);
+    }
+    assert(from);
+    node->hcode = old->hcode;
+    node->next = old->next;
+    __atomic_store_n(from, node, __ATOMIC_RELEASE);
+}
+
+void hm_scan(HMap *hmap, void (*f)(HNode *, void *), void *arg) {
+    h_scan(&hmap->ht_to, f, arg);
+    h_scan(&hmap->ht_from, f, arg);
+}
 
-    HNode **from = h_lookup(&hmap->ht_to, key, cmp);
-    if (from) {
-        return h_detach(&hmap->ht_to, from);
+struct HScanCtx {
+    HMap *hmap;
+    void (*f)(HNode *, void *);
+    void *arg;
+};
+
+static void hm_scan_bucket(int t, size_t idx, void *ctx) {
+    HScanCtx *c = (HScanCtx *)ctx;
+    HTable *table = t == 0 ? &c->hmap->ht_to : &c->hmap->ht_from;
+    for (HNode *node = table->table[idx]; node; node = node->next) {
+        c->f(node, c->arg);
     }
+}
 
-    from = h_lookup(&hmap->ht_from, key, cmp);
-    if (from) {
-        return h_detach(&hmap->ht_from, from);
+uint64_t hm_scan_step(HMap *hmap, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg) {
+    if (!hmap->ht_to.table) {
+        return 0;
     }
-    return NULL;
+    HScanCtx ctx{hmap, f, arg};
+    return h_cursor_step(cursor, hmap->ht_to.mask, hmap->ht_from.mask,
+                         hmap->ht_from.table != NULL, &hm_scan_bucket, &ctx);
 }
 
 void hm_destroy(HMap *hmap) {
-    free(hmap->ht_to.table);
-    free(hmap->ht_from.table);
+    h_free(&hmap->ht_to);
+    h_free(&hmap->ht_from);
     *hmap = HMap{}; // why?
 }
@@ -2,6 +2,7 @@
 #define HASHTABLE_H
 
 #include "constants.h"
+#include <cstddef>
 #include <cstdint>
 
 // pointer arithmetics to convert the pointer to HNode to pointer to Entry
@@ -20,6 +21,23 @@
  * **noexcept**
  */
 
+/**
+ * `container_of()` as a plain function, typed by the member pointer:
+ * `owner_of(node, &Entry::node)`
+ * `offsetof` does not take a member pointer, the offset is measured on an
+ * unconstructed object, which the compiler folds into a constant
+ */
+template <typename T, typename M> inline T *owner_of(M *ptr, M T::*member) {
+    union Probe {
+        char c;
+        T t;
+        Probe() {}
+        ~Probe() {}
+    } probe;
+    size_t off = (size_t)((char *)&(probe.t.*member) - (char *)&probe.t);
+    return (T *)((char *)ptr - off);
+}
+
 struct HNode {
     HNode *next = NULL;
     uint64_t hcode = 0;
@@ -31,12 +49,65 @@ struct HTable {
     size_t size = 0;
 };
 
+/**
+ * The resizes of one map; a resize is timed from its start to the last
+ * node moved, the migration itself is spread over many operations
+ */
+struct HResizeStats {
+    uint64_t count = 0;     // finished resizes
+    uint64_t last_usec = 0; // duration of the last one
+    uint64_t max_usec = 0;
+    uint64_t start_us = 0; // of the ongoing one
+};
+
+// CLOCK_MONOTONIC
+uint64_t h_now_usec();
+
+void h_resize_begin(HResizeStats *stats);
+void h_resize_end(HResizeStats *stats);
+
+/**
+ * Progressive resizing: `ht_from` is migrated into `ht_to` a bounded amount
+ * of work per operation
+ * - at most `K_RESIZING_WORK` nodes and `K_RESIZING_VISITS` buckets, so a
+ *   sparse `ht_from` does not turn one operation into a full scan
+ * - grows at `K_MAX_LOAD_FACTOR`, shrinks when the buckets outnumber the
+ *   nodes `K_SHRINK_RATIO` times (e.g. after a mass delete)
+ */
 struct HMap {
     HTable ht_to;
     HTable ht_from;
     size_t resizing_pos = 0;
+    HResizeStats resizes;
+    uint64_t seq = 0; // odd while nodes move between the tables
 };
 
+/**
+ * Seqlock, for readers on other threads (`--shared-reads`): the writer makes
+ * `*seq` odd for the duration of a change, a reader retries if it saw an odd
+ * value or if it changed before the reader was done
+ */
+inline void h_seq_begin(uint64_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+inline void h_seq_end(uint64_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+inline uint64_t h_seq_read(const uint64_t *seq) {
+    uint64_t v;
+    while ((v = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return v;
+}
+
+inline bool h_seq_changed(const uint64_t *seq, uint64_t v) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != v;
+}
+
 void h_init(HTable *htable, size_t n);
 
 /**
@@ -46,23 +117,241 @@ void h_insert(HTable *htable, HNode *node);
 
 HNode **h_lookup(HTable *htable, HNode *key, bool (*cmp)(HNode *, HNode *));
 
+/**
+ * Header-only lookup: `eq(HNode *)` is a template argument, so the
+ * comparison is inlined at the call site instead of an indirect call per
+ * probe; it only runs on the nodes with the same `hcode`
+ * `h_lookup()` and friends are thin wrappers for a function pointer
+ */
+template <typename Eq>
+inline HNode **h_find(HTable *htable, uint64_t hcode, Eq &&eq) {
+    if (!htable->table) {
+        return NULL;
+    }
+    HNode **from = &htable->table[hcode & htable->mask];
+    for (; *from; from = &(*from)->next) {
+        if ((*from)->hcode == hcode && eq(*from)) {
+            return from;
+        }
+    }
+    return NULL;
+}
+
 HNode *h_detach(HTable *htable, HNode **from);
 
 // scan through the entire hashtable and call f on every node
 void h_scan(HTable *table, void (*f)(HNode *, void *), void *arg);
 
+/**
+ * Cursor-based iteration over a table that may resize between the calls
+ * - the cursor is a bucket index incremented from its highest bit down
+ *   (reverse binary), so when the table doubles, bucket `i` splits into
+ *   `i` and `i + n` which are both ahead of or both behind the cursor
+ * - while resizing, a step visits the bucket of the smaller table and all
+ *   the buckets it expands to in the larger one
+ * - every node present during the whole scan is returned at least once,
+ *   some may be returned twice after a shrink
+ * `bucket(t, idx, ctx)` visits the bucket `idx` of table `t` (0: `mask0`,
+ * 1: `mask1`, which is ignored if `!two`); returns the next cursor, 0 when done
+ */
+uint64_t h_cursor_step(uint64_t cursor, size_t mask0, size_t mask1, bool two,
+                       void (*bucket)(int t, size_t idx, void *ctx),
+                       void *ctx);
+
 size_t hm_size(HMap *hmap);
 
 void hm_help_resizing(HMap *hmap);
 
+/**
+ * Extra migration when the server is idle, for at most `usec`
+ * Returns whether a resize is still ongoing
+ */
+bool hm_rehash_for(HMap *hmap, uint64_t usec);
+
+// number of buckets of both tables
+size_t hm_slots(HMap *hmap);
+
 HNode *hm_lookup(HMap *hmap, HNode *key, bool (*cmp)(HNode *, HNode *));
 
-void hm_start_resizing(HMap *hmap);
+void hm_start_resizing(HMap *hmap, size_t n);
 
 void hm_insert(HMap *hmap, HNode *node);
 
 HNode *hm_pop(HMap *hmap, HNode *key, bool (*cmp)(HNode *, HNode *));
 
+// start shrinking if the table became too sparse
+void hm_check_shrink(HMap *hmap);
+
+// `hm_lookup()` with an inlined comparator, see `h_find()`
+template <typename Eq>
+inline HNode *hm_find(HMap *hmap, uint64_t hcode, Eq &&eq) {
+    if (hmap->ht_from.table) {
+        hm_help_resizing(hmap);
+    }
+    HNode **from = h_find(&hmap->ht_to, hcode, eq);
+    if (!from) {
+        from = h_find(&hmap->ht_from, hcode, eq);
+    }
+    return from ? *from : NULL;
+}
+
+// `hm_pop()` with an inlined comparator
+template <typename Eq>
+inline HNode *hm_take(HMap *hmap, uint64_t hcode, Eq &&eq) {
+    if (hmap->ht_from.table) {
+        hm_help_resizing(hmap);
+    }
+    HNode *node = NULL;
+    HNode **from = h_find(&hmap->ht_to, hcode, eq);
+    if (from) {
+        node = h_detach(&hmap->ht_to, from);
+    } else if ((from = h_find(&hmap->ht_from, hcode, eq))) {
+        node = h_detach(&hmap->ht_from, from);
+    }
+
+    if (node) {
+        hm_check_shrink(hmap);
+    }
+    return node;
+}
+
+/**
+ * `hm_find()` for a thread other than the writer (`--shared-reads`), which
+ * only loads and never helps resizing
+ * - nodes are published with release stores and unlinked without touching
+ *   their own `next`, so a chain can be walked while the writer inserts and
+ *   deletes; the caller keeps the nodes alive with `ebr_enter()`
+ * - a migration step relinks nodes into the other table, the lookup starts
+ *   over if one ran meanwhile (`HMap::seq`)
+ */
+template <typename Eq>
+inline HNode *h_find_shared(HTable *htable, uint64_t hcode, Eq &eq,
+                            const uint64_t *seq, uint64_t v, bool *torn) {
+    HNode **table = __atomic_load_n(&htable->table, __ATOMIC_ACQUIRE);
+    size_t mask = __atomic_load_n(&htable->mask, __ATOMIC_RELAXED);
+    if (h_seq_changed(seq, v)) {
+        *torn = true;
+        return NULL;
+    }
+    if (!table) {
+        return NULL;
+    }
+    HNode *node = __atomic_load_n(&table[hcode & mask], __ATOMIC_ACQUIRE);
+    for (; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) {
+        if (node->hcode == hcode && eq(node)) {
+            return node;
+        }
+        if (h_seq_changed(seq, v)) {
+            *torn = true;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+template <typename Eq>
+inline HNode *hm_find_shared(HMap *hmap, uint64_t hcode, Eq &&eq) {
+    while (true) {
+        uint64_t v = h_seq_read(&hmap->seq);
+        bool torn = false;
+        HNode *node =
+            h_find_shared(&hmap->ht_to, hcode, eq, &hmap->seq, v, &torn);
+        if (!node && !torn) {
+            node =
+                h_find_shared(&hmap->ht_from, hcode, eq, &hmap->seq, v, &torn);
+        }
+        if (!torn) {
+            return node;
+        }
+    }
+}
+
+/**
+ * Put `node` in the place of `old`, with the same key: a reader sees one or
+ * the other, and one still on `old` follows its `next` into the chain
+ */
+void hm_replace(HMap *hmap, HNode *old, HNode *node);
+
+inline void h_prefetch(HTable *htable, uint64_t hcode) {
+    if (htable->table) {
+        __builtin_prefetch(&htable->table[hcode & htable->mask]);
+    }
+}
+
+inline void hm_prefetch(HMap *hmap, uint64_t hcode) {
+    h_prefetch(&hmap->ht_to, hcode);
+    h_prefetch(&hmap->ht_from, hcode);
+}
+
+/**
+ * Batched lookups, for the commands taking many keys: `hm_find()` of
+ * `n <= K_PREFETCH_BATCH` keys at once
+ * - the buckets of the whole batch are prefetched first
+ * - then the chains are walked in lock step: each round moves every
+ *   unresolved key one node further and prefetches the next node, so the
+ *   cache misses of the batch overlap instead of forming one dependent
+ *   chain per key
+ * `eq(i, node)` compares with the key `i`; `out[i]` is NULL if not found
+ */
+template <typename Eq>
+inline void hm_find_batch(HMap *hmap, const uint64_t *hcodes, size_t n,
+                          Eq &&eq, HNode **out) {
+    if (hmap->ht_from.table) {
+        hm_help_resizing(hmap);
+    }
+    HTable *tables[2] = {&hmap->ht_to, &hmap->ht_from};
+    HNode *curr[K_PREFETCH_BATCH];
+    uint8_t table[K_PREFETCH_BATCH]; // index into `tables` of `curr[i]`
+    for (size_t i = 0; i < n; ++i) {
+        hm_prefetch(hmap, hcodes[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        HTable *t = tables[0];
+        curr[i] = t->table ? t->table[hcodes[i] & t->mask] : NULL;
+        __builtin_prefetch(curr[i]);
+        table[i] = 0;
+        out[i] = NULL;
+    }
+
+    bool left = true;
+    while (left) {
+        left = false;
+        for (size_t i = 0; i < n; ++i) {
+            HNode *node = curr[i];
+            if (!node) {
+                HTable *t = tables[1];
+                if (table[i] == 0 && t->table) {
+                    // not in `ht_to`, go on with `ht_from`
+                    table[i] = 1;
+                    curr[i] = t->table[hcodes[i] & t->mask];
+                    __builtin_prefetch(curr[i]);
+                    left = true;
+                }
+                continue;
+            }
+            if (node->hcode == hcodes[i] && eq(i, node)) {
+                out[i] = node;
+                curr[i] = NULL;
+                table[i] = 1;
+                continue;
+            }
+            curr[i] = node->next;
+            __builtin_prefetch(curr[i]);
+            left = true;
+        }
+    }
+}
+
+// call f on every node of both tables
+void hm_scan(HMap *hmap, void (*f)(HNode *, void *), void *arg);
+
+/**
+ * One step of a cursor-based scan: call f on the nodes of one bucket
+ * (see `h_cursor_step()`), start with 0, returns 0 once done
+ */
+uint64_t hm_scan_step(HMap *hmap, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg);
+
 void hm_destroy(HMap *hmap);
 
 #endif /* HASHTABLE_H */
@@ -0,0 +1,299 @@
+#include "keyspace.h"
+#include "art.h"
+#include "constants.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "omap.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**
+ * `hash`: `HIndex`, the chained table or the open-addressing one
+ * (`--hashtable`); unordered, `walk` filters the keys below `start`
+ */
+static KNode *hash_lookup(Keyspace *ks, const LookupKey *lk) {
+    return hi_find(&ks->hash, &KNode::hnode, lk->hcode,
+                   [&](KNode *node) { return knode_key(node) == lk->key; });
+}
+
+static void hash_lookup_batch(Keyspace *ks, const LookupKey *lks, size_t n,
+                              KNode **out) {
+    uint64_t hcodes[K_PREFETCH_BATCH];
+    for (size_t i = 0; i < n; ++i) {
+        hcodes[i] = lks[i].hcode;
+    }
+    hi_find_batch(
+        &ks->hash, &KNode::hnode, hcodes, n,
+        [&](size_t i, KNode *node) { return knode_key(node) == lks[i].key; },
+        out);
+}
+
+static KNode *hash_upsert(Keyspace *ks, const LookupKey *lk, KNode *node) {
+    KNode *found = hash_lookup(ks, lk);
+    if (found) {
+        return found;
+    }
+    node->hnode.hcode = lk->hcode;
+    hi_insert(&ks->hash, &node->hnode);
+    return nullptr;
+}
+
+static KNode *hash_pop(Keyspace *ks, const LookupKey *lk) {
+    return hi_take(&ks->hash, &KNode::hnode, lk->hcode,
+                   [&](KNode *node) { return knode_key(node) == lk->key; });
+}
+
+static void hash_detach(Keyspace *ks, KNode *node) {
+    KNode *found = hi_take(&ks->hash, &KNode::hnode, node->hnode.hcode,
+                           [&](KNode *n) { return n == node; });
+    assert(found == node);
+    (void)found;
+}
+
+struct HashWalk {
+    std::string_view start;
+    bool (*f)(KNode *, std::string_view, void *);
+    void *arg;
+    bool done = false;
+};
+
+static void cb_hash_walk(HNode *hnode, void *arg) {
+    HashWalk *w = (HashWalk *)arg;
+    KNode *node = container_of(hnode, KNode, hnode);
+    std::string_view key = knode_key(node);
+    if (!w->done && key >= w->start) {
+        w->done = !w->f(node, key, w->arg);
+    }
+}
+
+static void hash_walk(Keyspace *ks, std::string_view start,
+                      bool (*f)(KNode *, std::string_view, void *),
+                      void *arg) {
+    HashWalk w{start, f, arg};
+    hi_scan(&ks->hash, &cb_hash_walk, &w);
+}
+
+static void hash_stats(Keyspace *ks, KeyspaceStats *out) {
+    out->keys = hi_size(&ks->hash);
+    out->slots = hi_slots(&ks->hash);
+    out->bytes = hi_mem_usage(&ks->hash);
+    out->resizing = hi_resizing(&ks->hash);
+    out->resizes = *hi_resize_stats(&ks->hash);
+}
+
+struct HashSample {
+    KNode **out;
+    size_t n;
+    size_t got = 0;
+};
+
+static void cb_hash_sample(HNode *hnode, void *arg) {
+    HashSample *s = (HashSample *)arg;
+    if (s->got < s->n) {
+        s->out[s->got++] = container_of(hnode, KNode, hnode);
+    }
+}
+
+// the nodes of random buckets, a few of them being empty
+static size_t hash_sample(Keyspace *ks, uint64_t rnd, KNode **out, size_t n) {
+    HashSample s{out, n};
+    for (size_t i = 0; i < 4 * n && s.got < n && hi_size(&ks->hash); ++i) {
+        (void)hi_scan_step(&ks->hash, rnd >> 16, &cb_hash_sample, &s);
+        rnd = rnd * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return s.got;
+}
+
+struct HashScan {
+    void (*f)(KNode *, void *);
+    void *arg;
+};
+
+static void cb_hash_scan(HNode *hnode, void *arg) {
+    HashScan *s = (HashScan *)arg;
+    s->f(container_of(hnode, KNode, hnode), s->arg);
+}
+
+static uint64_t hash_scan_step(Keyspace *ks, uint64_t cursor,
+                               void (*f)(KNode *, void *), void *arg) {
+    HashScan s{f, arg};
+    return hi_scan_step(&ks->hash, cursor, &cb_hash_scan, &s);
+}
+
+static bool hash_rehash_for(Keyspace *ks, uint64_t usec) {
+    return hi_rehash_for(&ks->hash, usec);
+}
+
+// the readers on other threads only know the chained table
+static KNode *hash_lookup_shared(Keyspace *ks, const LookupKey *lk) {
+    return hi_find_shared(
+        &ks->hash, &KNode::hnode, lk->hcode,
+        [&](KNode *node) { return knode_key(node) == lk->key; });
+}
+
+static void hash_replace(Keyspace *ks, KNode *old, KNode *node) {
+    hi_replace(&ks->hash, &old->hnode, &node->hnode);
+}
+
+static const KeyspaceEngine k_engine_hash = {
+    "hash",
+    true,
+    false,
+    &hash_lookup,
+    &hash_lookup_batch,
+    &hash_upsert,
+    &hash_pop,
+    &hash_detach,
+    &hash_walk,
+    &hash_stats,
+    &hash_sample,
+    &hash_scan_step,
+    &hash_rehash_for,
+    &hash_lookup_shared,
+    &hash_replace,
+};
+
+/**
+ * `art`: the adaptive radix tree, ordered
+ */
+static std::string_view knode_leaf_key(ArtLeaf *leaf) {
+    return knode_key(container_of(leaf, KNode, leaf));
+}
+
+static KNode *art_node(ArtLeaf *leaf) {
+    return leaf ? container_of(leaf, KNode, leaf) : nullptr;
+}
+
+static KNode *art_ks_lookup(Keyspace *ks, const LookupKey *lk) {
+    return art_node(art_lookup(&ks->art, lk->key));
+}
+
+static void art_ks_lookup_batch(Keyspace *ks, const LookupKey *lks, size_t n,
+                                KNode **out) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = art_ks_lookup(ks, &lks[i]);
+    }
+}
+
+static KNode *art_ks_upsert(Keyspace *ks, const LookupKey *lk, KNode *node) {
+    (void)lk;
+    return art_node(art_insert(&ks->art, &node->leaf));
+}
+
+static KNode *art_ks_pop(Keyspace *ks, const LookupKey *lk) {
+    return art_node(art_pop(&ks->art, lk->key));
+}
+
+static void art_ks_detach(Keyspace *ks, KNode *node) {
+    art_detach(&ks->art, &node->leaf);
+}
+
+struct ArtKsWalk {
+    bool (*f)(KNode *, std::string_view, void *);
+    void *arg;
+};
+
+static bool cb_art_walk(ArtLeaf *leaf, const std::string &key, void *arg) {
+    ArtKsWalk *w = (ArtKsWalk *)arg;
+    return w->f(art_node(leaf), key, w->arg);
+}
+
+static void art_ks_walk(Keyspace *ks, std::string_view start,
+                        bool (*f)(KNode *, std::string_view, void *),
+                        void *arg) {
+    ArtKsWalk w{f, arg};
+    art_walk(&ks->art, start, &cb_art_walk, &w);
+}
+
+static void art_ks_stats(Keyspace *ks, KeyspaceStats *out) {
+    out->keys = ks->art.size;
+    out->slots = ks->art.nodes;
+    out->bytes = ks->art.bytes;
+}
+
+static size_t art_ks_sample(Keyspace *ks, uint64_t rnd, KNode **out,
+                            size_t n) {
+    size_t got = 0;
+    for (; got < n && ks->art.size; ++got) {
+        out[got] = art_node(art_random(&ks->art, rnd));
+        rnd = rnd * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return got;
+}
+
+static const KeyspaceEngine k_engine_art = {
+    "art",
+    false,
+    true,
+    &art_ks_lookup,
+    &art_ks_lookup_batch,
+    &art_ks_upsert,
+    &art_ks_pop,
+    &art_ks_detach,
+    &art_ks_walk,
+    &art_ks_stats,
+    &art_ks_sample,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+static const KeyspaceEngine *const k_engines[] = {
+    &k_engine_hash,
+    &k_engine_art,
+};
+
+const KeyspaceEngine *ks_engine_find(const char *name) {
+    for (const KeyspaceEngine *engine : k_engines) {
+        if (0 == strcmp(engine->name, name)) {
+            return engine;
+        }
+    }
+    return nullptr;
+}
+
+const char *ks_engine_names() { return "hash|art"; }
+
+void ks_init(Keyspace *ks, const KeyspaceEngine *engine) {
+    ks->engine = engine;
+    ks->art.leaf_key = &knode_leaf_key;
+}
+
+void ks_key_init(Keyspace *ks, LookupKey *lk, std::string_view key) {
+    lk->key = key;
+    if (ks->engine->hashed) {
+        lk->hcode = str_hash((uint8_t *)key.data(), key.size());
+    }
+}
+
+size_t ks_size(Keyspace *ks) {
+    KeyspaceStats st;
+    ks_stats(ks, &st);
+    return st.keys;
+}
+
+size_t ks_mem_usage(Keyspace *ks) {
+    KeyspaceStats st;
+    ks_stats(ks, &st);
+    return st.bytes;
+}
+
+void ks_stats(Keyspace *ks, KeyspaceStats *out) {
+    *out = KeyspaceStats{};
+    ks->engine->stats(ks, out);
+}
+
+bool ks_resizing(Keyspace *ks) {
+    KeyspaceStats st;
+    ks_stats(ks, &st);
+    return st.resizing;
+}
+
+bool ks_rehash_for(Keyspace *ks, uint64_t usec) {
+    return ks->engine->rehash_for ? ks->engine->rehash_for(ks, usec) : false;
+}
@@ -0,0 +1,155 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include "art.h"
+#include "hashtable.h"
+#include "omap.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Intrusive node of the keyspace, embedded in the value like `HNode`
+ * The engine decides which member of the union is used
+ * The key bytes follow the node, in the same allocation as the value: the
+ * node is the last member of the value
+ */
+struct KNode {
+    union {
+        HNode hnode{};
+        ArtLeaf leaf;
+    };
+    uint32_t klen = 0;
+    char key[0];
+};
+
+inline std::string_view knode_key(const KNode *node) {
+    return std::string_view(node->key, node->klen);
+}
+
+/**
+ * A key being probed, `key` usually references the request bytes
+ * `hcode` is only set for the engines that hash (`ks_key_init()`)
+ */
+struct LookupKey {
+    std::string_view key;
+    uint64_t hcode = 0;
+};
+
+struct KeyspaceStats {
+    size_t keys = 0;
+    size_t slots = 0; // buckets or slots, the inner nodes of a tree
+    size_t bytes = 0; // the index itself, without the nodes it links
+    bool resizing = false;
+    HResizeStats resizes;
+};
+
+struct KeyspaceEngine;
+
+/**
+ * The keyspace of one shard; `engine` picks the index, only that member is
+ * used
+ */
+struct Keyspace {
+    const KeyspaceEngine *engine = nullptr;
+    HIndex hash;
+    ArtTree art;
+};
+
+/**
+ * The operations of a keyspace index, one table per engine, picked once at
+ * startup (`--keyspace`); the commands only go through `ks_*()`, so another
+ * index is one more table
+ * The optional operations are NULL when the engine does not have them
+ */
+struct KeyspaceEngine {
+    const char *name;
+    bool hashed;  // uses `LookupKey::hcode`
+    bool ordered; // `walk` goes in key order
+
+    KNode *(*lookup)(Keyspace *ks, const LookupKey *lk);
+    // `lookup` of `n <= K_PREFETCH_BATCH` keys, NULL for the missing ones
+    void (*lookup_batch)(Keyspace *ks, const LookupKey *lks, size_t n,
+                         KNode **out);
+    // links `node`, holding the key of `lk`, unless the key is already
+    // there: then the node holding it is returned and nothing changes
+    KNode *(*upsert)(Keyspace *ks, const LookupKey *lk, KNode *node);
+    KNode *(*pop)(Keyspace *ks, const LookupKey *lk);
+    void (*detach)(Keyspace *ks, KNode *node);
+    /**
+     * Every key >= `start` (all for ""), in order if the engine is
+     * `ordered`, until `f` returns false; `key` is the full key
+     */
+    void (*walk)(Keyspace *ks, std::string_view start,
+                 bool (*f)(KNode *node, std::string_view key, void *arg),
+                 void *arg);
+    void (*stats)(Keyspace *ks, KeyspaceStats *out);
+    // up to `n` keys picked at random from `rnd`, maybe the same one twice;
+    // fewer only if the keyspace is almost empty
+    size_t (*sample)(Keyspace *ks, uint64_t rnd, KNode **out, size_t n);
+
+    // optional: cursor-based iteration, see `h_cursor_step()`
+    uint64_t (*scan_step)(Keyspace *ks, uint64_t cursor,
+                          void (*f)(KNode *node, void *arg), void *arg);
+    // optional: background work of an ongoing resize, see `hm_rehash_for()`
+    bool (*rehash_for)(Keyspace *ks, uint64_t usec);
+    // optional: lookups from other threads, see `hm_find_shared()`
+    KNode *(*lookup_shared)(Keyspace *ks, const LookupKey *lk);
+    // optional: `node` takes the place of `old`, under the shared readers
+    void (*replace)(Keyspace *ks, KNode *old, KNode *node);
+};
+
+// NULL if there is no such engine
+const KeyspaceEngine *ks_engine_find(const char *name);
+
+// the names of the engines, for the usage message
+const char *ks_engine_names();
+
+void ks_init(Keyspace *ks, const KeyspaceEngine *engine);
+
+void ks_key_init(Keyspace *ks, LookupKey *lk, std::string_view key);
+
+inline KNode *ks_lookup(Keyspace *ks, const LookupKey *lk) {
+    return ks->engine->lookup(ks, lk);
+}
+
+inline void ks_lookup_batch(Keyspace *ks, const LookupKey *lks, size_t n,
+                            KNode **out) {
+    ks->engine->lookup_batch(ks, lks, n, out);
+}
+
+inline KNode *ks_upsert(Keyspace *ks, const LookupKey *lk, KNode *node) {
+    return ks->engine->upsert(ks, lk, node);
+}
+
+inline KNode *ks_pop(Keyspace *ks, const LookupKey *lk) {
+    return ks->engine->pop(ks, lk);
+}
+
+inline void ks_detach(Keyspace *ks, KNode *node) {
+    ks->engine->detach(ks, node);
+}
+
+inline void ks_walk(Keyspace *ks, std::string_view start,
+                    bool (*f)(KNode *node, std::string_view key, void *arg),
+                    void *arg) {
+    ks->engine->walk(ks, start, f, arg);
+}
+
+inline size_t ks_sample(Keyspace *ks, uint64_t rnd, KNode **out, size_t n) {
+    return ks->engine->sample(ks, rnd, out, n);
+}
+
+size_t ks_size(Keyspace *ks);
+
+// bytes of the index, without the nodes
+size_t ks_mem_usage(Keyspace *ks);
+
+void ks_stats(Keyspace *ks, KeyspaceStats *out);
+
+bool ks_resizing(Keyspace *ks);
+
+// whether a resize is still ongoing, see `hm_rehash_for()`
+bool ks_rehash_for(Keyspace *ks, uint64_t usec);
+
+#endif /* KEYSPACE_H */
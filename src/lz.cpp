@@ -0,0 +1,185 @@
+#include "lz.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+const size_t K_LZ_MIN_MATCH = 4;
+const size_t K_LZ_MAX_OFFSET = 65535;
+const uint32_t K_LZ_HASH_BITS = 12; // 16KB of positions, on the stack
+// as in LZ4: a match starts 12 bytes before the end at the latest, and the
+// last 5 bytes are literals
+const size_t K_LZ_MF_LIMIT = 12;
+const size_t K_LZ_LAST_LITERALS = 5;
+
+static uint32_t load32(const uint8_t *p) {
+    uint32_t v = 0;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - K_LZ_HASH_BITS);
+}
+
+// what is past the 15 of a token field: 255 per byte, then the rest
+static bool put_len(uint8_t *&op, uint8_t *end, size_t n) {
+    for (; n >= 255; n -= 255) {
+        if (op >= end) {
+            return false;
+        }
+        *op++ = 255;
+    }
+    if (op >= end) {
+        return false;
+    }
+    *op++ = (uint8_t)n;
+    return true;
+}
+
+/**
+ * One sequence: `nlit` literals then a match of `mlen` bytes `offset`
+ * back, no match for the last one (`mlen` 0)
+ */
+static bool put_seq(uint8_t *&op, uint8_t *end, const uint8_t *lit,
+                    size_t nlit, size_t offset, size_t mlen) {
+    if (op >= end) {
+        return false;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15 && !put_len(op, end, nlit - 15)) {
+        return false;
+    }
+    if ((size_t)(end - op) < nlit) {
+        return false;
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen) {
+        return true;
+    }
+
+    if (end - op < 2) {
+        return false;
+    }
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    size_t m = mlen - K_LZ_MIN_MATCH;
+    *token |= (uint8_t)(m < 15 ? m : 15);
+    return m < 15 || put_len(op, end, m - 15);
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    assert(len < UINT32_MAX);
+    uint8_t *op = dst;
+    uint8_t *end = dst + cap;
+    size_t anchor = 0; // the literals pending from there
+
+    if (len > K_LZ_MF_LIMIT) {
+        // the last position of each hash, 0 until seen: the bytes tell
+        uint32_t table[1 << K_LZ_HASH_BITS] = {};
+        size_t limit = len - K_LZ_MF_LIMIT;
+        size_t match_end = len - K_LZ_LAST_LITERALS;
+        size_t ip = 0;
+        while (ip < limit) {
+            uint32_t seq = load32(&src[ip]);
+            uint32_t h = lz_hash(seq);
+            size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > K_LZ_MAX_OFFSET ||
+                load32(&src[ref]) != seq) {
+                // faster over what does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // the match may start among the pending literals
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t mlen = K_LZ_MIN_MATCH;
+            while (ip + mlen < match_end &&
+                   src[ip + mlen] == src[ref + mlen]) {
+                mlen++;
+            }
+            if (!put_seq(op, end, &src[anchor], ip - anchor, ip - ref,
+                         mlen)) {
+                return 0;
+            }
+            ip += mlen;
+            anchor = ip;
+            // the position just before, for the next match to find
+            if (ip - 2 < limit) {
+                table[lz_hash(load32(&src[ip - 2]))] = (uint32_t)(ip - 2);
+            }
+        }
+    }
+
+    if (!put_seq(op, end, &src[anchor], len - anchor, 0, 0)) {
+        return 0;
+    }
+    return (size_t)(op - dst);
+}
+
+static bool get_len(const uint8_t *&ip, const uint8_t *end, size_t &n) {
+    uint8_t b = 0;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        b = *ip++;
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t len) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + n;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + len;
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !get_len(ip, iend, nlit)) {
+            return false;
+        }
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit) {
+            return false;
+        }
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend) {
+            break; // the last sequence
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !get_len(ip, iend, mlen)) {
+            return false;
+        }
+        mlen += K_LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) ||
+            (size_t)(oend - op) < mlen) {
+            return false;
+        }
+        const uint8_t *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+        } else {
+            // overlapping: a run repeating the last `offset` bytes
+            for (size_t i = 0; i < mlen; ++i) {
+                op[i] = ref[i];
+            }
+        }
+        op += mlen;
+    }
+    return op == oend;
+}
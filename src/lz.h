@@ -0,0 +1,36 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Byte-oriented LZ77 codec, in the block format of LZ4, for the string
+ * values (`--compress`)
+ * - a sequence is a token, literal bytes, then a match: a 2-byte offset
+ *   back into the output and a length of at least 4; the token holds the
+ *   literal count in its high 4 bits and the match length - 4 in the low
+ *   ones, 15 meaning more in the bytes that follow (255 at a time)
+ * - the last sequence only has literals, the last 5 bytes always are
+ * - greedy matching of the 4-byte sequences through a small hash table of
+ *   the positions seen last, no entropy coding: fast both ways, at the
+ *   ratio of LZ4 on text like JSON
+ */
+
+// the size of the output when nothing matches
+inline size_t lz_bound(size_t len) { return len + len / 255 + 16; }
+
+/**
+ * `len` bytes of `src` into at most `cap` bytes of `dst`
+ * Returns the compressed size, 0 if it does not fit
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/**
+ * `n` compressed bytes into exactly `len` bytes of `dst`
+ * Returns false if it is not a block of that size; never reads or writes
+ * out of bounds, whatever `src` holds
+ */
+bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t len);
+
+#endif /* LZ_H */
@@ -0,0 +1,42 @@
+#include "mailbox.h"
+#include "utils.h"
+#include <cassert>
+#include <cstdint>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+void mailbox_init(Mailbox *mb) {
+    int rv = pthread_mutex_init(&(mb->mu), nullptr);
+    assert(rv == 0);
+    mb->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mb->efd < 0) {
+        die("eventfd()");
+    }
+}
+
+void mailbox_post(Mailbox *mb, void *msg) {
+    pthread_mutex_lock(&(mb->mu));
+    bool was_empty = mb->queue.empty();
+    mb->queue.push_back(msg);
+    pthread_mutex_unlock(&(mb->mu));
+
+    // only the first message needs to wake up the consumer,
+    // the rest are picked up by the same `mailbox_drain()`
+    if (was_empty) {
+        uint64_t one = 1;
+        (void)write(mb->efd, &one, sizeof(one));
+    }
+}
+
+void mailbox_drain(Mailbox *mb, std::vector<void *> &out) {
+    // reset the eventfd _before_ taking the queue, so a message posted in
+    // between is either taken now or signaled again
+    uint64_t cnt = 0;
+    (void)read(mb->efd, &cnt, sizeof(cnt));
+
+    out.clear();
+    pthread_mutex_lock(&(mb->mu));
+    out.swap(mb->queue);
+    pthread_mutex_unlock(&(mb->mu));
+}
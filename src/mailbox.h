@@ -0,0 +1,30 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <pthread.h>
+#include <vector>
+
+/**
+ * Multi-producer, single-consumer message queue between event loops
+ * The consumer watches `efd` (an eventfd) in its event loop, it becomes
+ * readable when messages are posted to an empty queue
+ */
+struct Mailbox {
+    std::vector<void *> queue;
+    pthread_mutex_t mu;
+    int efd = -1;
+};
+
+void mailbox_init(Mailbox *mb);
+
+/**
+ * Producer, can be called from any thread
+ */
+void mailbox_post(Mailbox *mb, void *msg);
+
+/**
+ * Consumer, takes all the pending messages at once
+ */
+void mailbox_drain(Mailbox *mb, std::vector<void *> &out);
+
+#endif /* MAILBOX_H */
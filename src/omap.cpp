@@ -0,0 +1,327 @@
+#include "omap.h"
+#include "constants.h"
+#include "hashtable.h"
+#include "slab.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// bitmap of the empty or deleted slots
+static uint32_t group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(group);
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < K_GROUP; ++i) {
+        bits |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+    return bits;
+#endif
+}
+
+static size_t ot_capacity(size_t n) { return n - n / 8; }
+
+static void ot_init(OTable *table, size_t n) {
+    assert(n >= K_GROUP && ((n - 1) & n) == 0); // power of 2, whole groups
+    // the small tables from the slabs, aligned to 16 like a group
+    table->ctrl = (uint8_t *)slab_alloc(n);
+    table->slots = (HNode **)slab_alloc(n * sizeof(HNode *));
+    assert(table->ctrl && table->slots);
+    memset(table->ctrl, K_CTRL_EMPTY, n);
+    table->mask = n - 1;
+    table->size = 0;
+    table->growth_left = ot_capacity(n);
+}
+
+static void ot_free(OTable *table) {
+    size_t n = table->ctrl ? table->mask + 1 : 0;
+    slab_free(table->ctrl, n);
+    slab_free(table->slots, n * sizeof(HNode *));
+    *table = OTable{};
+}
+
+/**
+ * The caller makes sure there is room (`growth_left`)
+ */
+static void ot_insert(OTable *table, HNode *node) {
+    size_t gmask = table->mask / K_GROUP;
+    size_t group = home_group(node->hcode) & gmask;
+    for (size_t step = 1;; ++step) {
+        uint32_t bits = group_match_free(&table->ctrl[group * K_GROUP]);
+        if (bits) {
+            size_t pos = group * K_GROUP + (size_t)__builtin_ctz(bits);
+            if (table->ctrl[pos] == K_CTRL_EMPTY) {
+                assert(table->growth_left > 0);
+                table->growth_left--;
+            }
+            table->ctrl[pos] = ctrl_tag(node->hcode);
+            table->slots[pos] = node;
+            table->size++;
+            return;
+        }
+        assert(step <= gmask);
+        group = (group + step) & gmask;
+    }
+}
+
+HNode *ot_detach(OTable *table, size_t pos) {
+    HNode *node = table->slots[pos];
+    const uint8_t *ctrl = &table->ctrl[pos & ~(K_GROUP - 1)];
+    if (group_match(ctrl, K_CTRL_EMPTY)) {
+        // no probe went past this group, no tombstone needed
+        table->ctrl[pos] = K_CTRL_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[pos] = K_CTRL_DELETED;
+    }
+    table->size--;
+    return node;
+}
+
+static void ot_scan(OTable *table, void (*f)(HNode *, void *), void *arg) {
+    if (table->size == 0) {
+        return;
+    }
+    for (size_t i = 0; i < table->mask + 1; ++i) {
+        if (!(table->ctrl[i] & 0x80)) {
+            f(table->slots[i], arg);
+        }
+    }
+}
+
+size_t om_size(OMap *omap) { return omap->ot_to.size + omap->ot_from.size; }
+
+void om_help_resizing(OMap *omap) {
+    OTable *from = &omap->ot_from;
+    OTable *to = &omap->ot_to;
+    if (!from->ctrl) {
+        return;
+    }
+
+    size_t nslots = from->mask + 1;
+    size_t end = omap->migrate_pos + K_RESIZING_WORK;
+    end = end < nslots ? end : nslots;
+    size_t pos = omap->migrate_pos;
+    for (; pos < end && from->size && to->growth_left; ++pos) {
+        if (!(from->ctrl[pos] & 0x80)) {
+            ot_insert(to, ot_detach(from, pos));
+        }
+    }
+    omap->migrate_pos = pos;
+
+    if (from->size == 0) {
+        // resizing finished
+        ot_free(from);
+        h_resize_end(&omap->resizes);
+    }
+}
+
+size_t om_slots(OMap *omap) {
+    size_t n = omap->ot_to.ctrl ? omap->ot_to.mask + 1 : 0;
+    return n + (omap->ot_from.ctrl ? omap->ot_from.mask + 1 : 0);
+}
+
+bool om_rehash_for(OMap *omap, uint64_t usec) {
+    uint64_t deadline = h_now_usec() + usec;
+    // stops early if `ot_to` is full, the next insertion will finish it
+    while (omap->ot_from.ctrl && omap->ot_to.growth_left) {
+        for (size_t i = 0; i < 8 && omap->ot_from.ctrl; ++i) {
+            om_help_resizing(omap);
+        }
+        if (h_now_usec() >= deadline) {
+            break;
+        }
+    }
+    return omap->ot_from.ctrl != NULL;
+}
+
+static void ot_move_all(OTable *dst, OTable *src) {
+    for (size_t i = 0; src->size && i < src->mask + 1; ++i) {
+        if (!(src->ctrl[i] & 0x80)) {
+            ot_insert(dst, ot_detach(src, i));
+        }
+    }
+    ot_free(src);
+}
+
+/**
+ * Also used to purge the tombstones, the new table can be the same size
+ */
+static void om_start_resizing(OMap *omap) {
+    // half full once the nodes are migrated
+    size_t n = K_GROUP;
+    while (ot_capacity(n) < 2 * om_size(omap)) {
+        n *= 2;
+    }
+    OTable fresh;
+    ot_init(&fresh, n);
+
+    if (omap->ot_from.ctrl) {
+        // rare: the previous migration has not finished, move everything now
+        ot_move_all(&fresh, &omap->ot_from);
+        ot_move_all(&fresh, &omap->ot_to);
+        omap->ot_to = fresh;
+        h_resize_end(&omap->resizes);
+        return;
+    }
+    h_resize_begin(&omap->resizes);
+    omap->ot_from = omap->ot_to;
+    omap->ot_to = fresh;
+    omap->migrate_pos = 0;
+}
+
+HNode *om_lookup(OMap *omap, HNode *key, bool (*cmp)(HNode *, HNode *)) {
+    return om_find(omap, key->hcode,
+                   [&](HNode *node) { return cmp(node, key); });
+}
+
+void om_insert(OMap *omap, HNode *node) {
+    if (!omap->ot_to.ctrl) {
+        ot_init(&omap->ot_to, K_GROUP);
+    } else if (omap->ot_to.growth_left == 0) {
+        om_start_resizing(omap);
+    }
+    ot_insert(&omap->ot_to, node);
+    om_help_resizing(omap);
+}
+
+void om_check_shrink(OMap *omap) {
+    OTable *to = &omap->ot_to;
+    if (!omap->ot_from.ctrl && to->mask + 1 > K_GROUP &&
+        to->size * K_SHRINK_RATIO < to->mask + 1) {
+        om_start_resizing(omap);
+    }
+}
+
+HNode *om_pop(OMap *omap, HNode *key, bool (*cmp)(HNode *, HNode *)) {
+    return om_take(omap, key->hcode,
+                   [&](HNode *node) { return cmp(node, key); });
+}
+
+void om_scan(OMap *omap, void (*f)(HNode *, void *), void *arg) {
+    ot_scan(&omap->ot_to, f, arg);
+    ot_scan(&omap->ot_from, f, arg);
+}
+
+struct OScanCtx {
+    OMap *omap;
+    void (*f)(HNode *, void *);
+    void *arg;
+};
+
+/**
+ * The nodes whose home group is `group`: the same probe as a lookup,
+ * keeping the nodes of that home
+ */
+static void om_scan_group(int t, size_t group, void *ctx) {
+    OScanCtx *c = (OScanCtx *)ctx;
+    OTable *table = t == 0 ? &c->omap->ot_to : &c->omap->ot_from;
+    size_t gmask = table->mask / K_GROUP;
+    size_t g = group;
+    for (size_t step = 1; step <= gmask + 1; ++step) {
+        const uint8_t *ctrl = &table->ctrl[g * K_GROUP];
+        for (size_t i = 0; i < K_GROUP; ++i) {
+            HNode *node = table->slots[g * K_GROUP + i];
+            if (!(ctrl[i] & 0x80) && (home_group(node->hcode) & gmask) == group) {
+                c->f(node, c->arg);
+            }
+        }
+        if (group_match(ctrl, K_CTRL_EMPTY)) {
+            break;
+        }
+        g = (g + step) & gmask;
+    }
+}
+
+uint64_t om_scan_step(OMap *omap, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg) {
+    if (!omap->ot_to.ctrl) {
+        return 0;
+    }
+    OScanCtx ctx{omap, f, arg};
+    return h_cursor_step(cursor, omap->ot_to.mask / K_GROUP,
+                         omap->ot_from.mask / K_GROUP,
+                         omap->ot_from.ctrl != NULL, &om_scan_group, &ctx);
+}
+
+void om_destroy(OMap *omap) {
+    ot_free(&omap->ot_to);
+    ot_free(&omap->ot_from);
+    *omap = OMap{};
+}
+
+bool g_open_addressing = false;
+
+void hi_use_open_addressing(bool on) { g_open_addressing = on; }
+
+size_t hi_size(HIndex *index) {
+    return g_open_addressing ? om_size(&index->omap) : hm_size(&index->hmap);
+}
+
+size_t hi_slots(HIndex *index) {
+    return g_open_addressing ? om_slots(&index->omap) : hm_slots(&index->hmap);
+}
+
+size_t hi_mem_usage(HIndex *index) {
+    // the open-addressing table has a control byte per slot
+    return hi_slots(index) * (sizeof(HNode *) + (g_open_addressing ? 1 : 0));
+}
+
+bool hi_resizing(HIndex *index) {
+    return g_open_addressing ? index->omap.ot_from.ctrl != NULL
+                             : index->hmap.ht_from.table != NULL;
+}
+
+bool hi_rehash_for(HIndex *index, uint64_t usec) {
+    return g_open_addressing ? om_rehash_for(&index->omap, usec)
+                             : hm_rehash_for(&index->hmap, usec);
+}
+
+const HResizeStats *hi_resize_stats(HIndex *index) {
+    return g_open_addressing ? &index->omap.resizes : &index->hmap.resizes;
+}
+
+HNode *hi_lookup(HIndex *index, HNode *key, bool (*cmp)(HNode *, HNode *)) {
+    return g_open_addressing ? om_lookup(&index->omap, key, cmp)
+                             : hm_lookup(&index->hmap, key, cmp);
+}
+
+void hi_insert(HIndex *index, HNode *node) {
+    if (g_open_addressing) {
+        om_insert(&index->omap, node);
+    } else {
+        hm_insert(&index->hmap, node);
+    }
+}
+
+HNode *hi_pop(HIndex *index, HNode *key, bool (*cmp)(HNode *, HNode *)) {
+    return g_open_addressing ? om_pop(&index->omap, key, cmp)
+                             : hm_pop(&index->hmap, key, cmp);
+}
+
+void hi_replace(HIndex *index, HNode *old, HNode *node) {
+    assert(!g_open_addressing);
+    hm_replace(&index->hmap, old, node);
+}
+
+void hi_scan(HIndex *index, void (*f)(HNode *, void *), void *arg) {
+    if (g_open_addressing) {
+        om_scan(&index->omap, f, arg);
+    } else {
+        hm_scan(&index->hmap, f, arg);
+    }
+}
+
+uint64_t hi_scan_step(HIndex *index, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg) {
+    return g_open_addressing ? om_scan_step(&index->omap, cursor, f, arg)
+                             : hm_scan_step(&index->hmap, cursor, f, arg);
+}
+
+void hi_destroy(HIndex *index) {
+    om_destroy(&index->omap);
+    hm_destroy(&index->hmap);
+}
@@ -0,0 +1,282 @@
+#ifndef OMAP_H
+#define OMAP_H
+
+#include "hashtable.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Open-addressing hashtable of intrusive `HNode`s, Swiss-table style
+ * - the slots are grouped by 16, each slot has a control byte:
+ *   empty, deleted (a tombstone), or a 7-bit tag taken from `hcode`
+ * - a lookup compares the tags of a whole group at once (SSE2) and only
+ *   dereferences the nodes whose tag matches, instead of chasing a chain of
+ *   pointers; a miss usually costs one control group and no node at all
+ * - the groups are probed with triangular steps, the table grows at 7/8 load
+ * - `HNode::next` is not used
+ */
+struct OTable {
+    uint8_t *ctrl = nullptr; // one control byte per slot, 16-byte aligned
+    HNode **slots = nullptr;
+    size_t mask = 0; // number of slots - 1
+    size_t size = 0;
+    size_t growth_left = 0; // empty slots that can still be filled
+};
+
+const size_t K_GROUP = 16;
+
+// a full slot has the high bit clear, see `ctrl_tag()`
+const uint8_t K_CTRL_EMPTY = 0x80;
+const uint8_t K_CTRL_DELETED = 0xFE;
+
+/**
+ * The low 7 bits of the hash are the tag, the rest select the first group
+ */
+inline uint8_t ctrl_tag(uint64_t hcode) { return (uint8_t)(hcode & 0x7F); }
+inline size_t home_group(uint64_t hcode) { return (size_t)(hcode >> 7); }
+
+// bitmap of the slots of the group whose control byte is `tag`
+inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    __m128i match = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag));
+    return (uint32_t)_mm_movemask_epi8(match);
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < K_GROUP; ++i) {
+        bits |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return bits;
+#endif
+}
+
+/**
+ * Returns the slot of the node, or `SIZE_MAX`; `eq(HNode *)` is inlined,
+ * see `h_find()`
+ */
+template <typename Eq>
+inline size_t ot_find(OTable *table, uint64_t hcode, Eq &&eq) {
+    if (!table->ctrl) {
+        return SIZE_MAX;
+    }
+
+    size_t gmask = table->mask / K_GROUP;
+    size_t group = home_group(hcode) & gmask;
+    uint8_t tag = ctrl_tag(hcode);
+    // triangular probing visits every group once
+    for (size_t step = 1; step <= gmask + 1; ++step) {
+        const uint8_t *ctrl = &table->ctrl[group * K_GROUP];
+        for (uint32_t bits = group_match(ctrl, tag); bits; bits &= bits - 1) {
+            size_t pos = group * K_GROUP + (size_t)__builtin_ctz(bits);
+            HNode *node = table->slots[pos];
+            if (node->hcode == hcode && eq(node)) {
+                return pos;
+            }
+        }
+        if (group_match(ctrl, K_CTRL_EMPTY)) {
+            // an insertion would have stopped here
+            return SIZE_MAX;
+        }
+        group = (group + step) & gmask;
+    }
+    return SIZE_MAX;
+}
+
+HNode *ot_detach(OTable *table, size_t pos);
+
+/**
+ * Same incremental resizing as `HMap`: `ot_from` is migrated into `ot_to`
+ * a bounded number of slots per operation; also shrinks after mass deletes
+ */
+struct OMap {
+    OTable ot_to;
+    OTable ot_from;
+    size_t migrate_pos = 0;
+    HResizeStats resizes;
+};
+
+size_t om_size(OMap *omap);
+
+// number of slots of both tables
+size_t om_slots(OMap *omap);
+
+// see `hm_rehash_for()`
+bool om_rehash_for(OMap *omap, uint64_t usec);
+
+/**
+ * Move at most `K_RESIZING_WORK` slots (empty or not) of `ot_from`
+ * Pauses if `ot_to` is full, `om_insert()` deals with it
+ */
+void om_help_resizing(OMap *omap);
+
+// the same rule as `HMap`, the new table is sized by `om_start_resizing()`
+void om_check_shrink(OMap *omap);
+
+HNode *om_lookup(OMap *omap, HNode *key, bool (*cmp)(HNode *, HNode *));
+
+void om_insert(OMap *omap, HNode *node);
+
+HNode *om_pop(OMap *omap, HNode *key, bool (*cmp)(HNode *, HNode *));
+
+// `om_lookup()` with an inlined comparator
+template <typename Eq>
+inline HNode *om_find(OMap *omap, uint64_t hcode, Eq &&eq) {
+    if (omap->ot_from.ctrl) {
+        om_help_resizing(omap);
+    }
+    size_t pos = ot_find(&omap->ot_to, hcode, eq);
+    if (pos != SIZE_MAX) {
+        return omap->ot_to.slots[pos];
+    }
+    pos = ot_find(&omap->ot_from, hcode, eq);
+    return pos != SIZE_MAX ? omap->ot_from.slots[pos] : NULL;
+}
+
+// `om_pop()` with an inlined comparator
+template <typename Eq>
+inline HNode *om_take(OMap *omap, uint64_t hcode, Eq &&eq) {
+    if (omap->ot_from.ctrl) {
+        om_help_resizing(omap);
+    }
+    HNode *node = NULL;
+    size_t pos = ot_find(&omap->ot_to, hcode, eq);
+    if (pos != SIZE_MAX) {
+        node = ot_detach(&omap->ot_to, pos);
+    } else if ((pos = ot_find(&omap->ot_from, hcode, eq)) != SIZE_MAX) {
+        node = ot_detach(&omap->ot_from, pos);
+    }
+
+    if (node) {
+        om_check_shrink(omap);
+    }
+    return node;
+}
+
+/**
+ * See `hm_find_batch()`; the probes of different keys do not depend on each
+ * other, so the CPU already overlaps them, prefetching the control groups
+ * and slots of the batch up front only helps a little
+ */
+inline void ot_prefetch(OTable *table, uint64_t hcode) {
+    if (table->ctrl) {
+        size_t pos = (home_group(hcode) & (table->mask / K_GROUP)) * K_GROUP;
+        __builtin_prefetch(&table->ctrl[pos]);
+        __builtin_prefetch(&table->slots[pos]);
+    }
+}
+
+template <typename Eq>
+inline void om_find_batch(OMap *omap, const uint64_t *hcodes, size_t n,
+                          Eq &&eq, HNode **out) {
+    for (size_t i = 0; i < n; ++i) {
+        ot_prefetch(&omap->ot_to, hcodes[i]);
+        ot_prefetch(&omap->ot_from, hcodes[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = om_find(omap, hcodes[i],
+                         [&](HNode *node) { return eq(i, node); });
+    }
+}
+
+// call f on every node
+void om_scan(OMap *omap, void (*f)(HNode *, void *), void *arg);
+
+/**
+ * Cursor-based scan (see `h_cursor_step()`), the "bucket" being the nodes
+ * of the same home group, which do not move when other nodes come and go
+ */
+uint64_t om_scan_step(OMap *omap, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg);
+
+void om_destroy(OMap *omap);
+
+/**
+ * The keyspace and the sorted sets use either table, picked once at startup
+ * (`--hashtable`) before any of them is created
+ */
+struct HIndex {
+    HMap hmap;
+    OMap omap;
+};
+
+// set by `hi_use_open_addressing()`
+extern bool g_open_addressing;
+
+void hi_use_open_addressing(bool on);
+
+size_t hi_size(HIndex *index);
+size_t hi_slots(HIndex *index);
+// bytes of the tables, both of them during a resize
+size_t hi_mem_usage(HIndex *index);
+bool hi_resizing(HIndex *index);
+bool hi_rehash_for(HIndex *index, uint64_t usec);
+const HResizeStats *hi_resize_stats(HIndex *index);
+HNode *hi_lookup(HIndex *index, HNode *key, bool (*cmp)(HNode *, HNode *));
+void hi_insert(HIndex *index, HNode *node);
+HNode *hi_pop(HIndex *index, HNode *key, bool (*cmp)(HNode *, HNode *));
+void hi_scan(HIndex *index, void (*f)(HNode *, void *), void *arg);
+uint64_t hi_scan_step(HIndex *index, uint64_t cursor,
+                      void (*f)(HNode *, void *), void *arg);
+void hi_destroy(HIndex *index);
+
+/**
+ * Typed lookups with an inlined comparator: `T` holds its `HNode` as
+ * `member`, `eq(T *)` only runs on the nodes with the same `hcode`
+ */
+template <typename T, typename Eq>
+inline T *hi_find(HIndex *index, HNode T::*member, uint64_t hcode, Eq &&eq) {
+    auto match = [&](HNode *node) { return eq(owner_of(node, member)); };
+    HNode *node = g_open_addressing ? om_find(&index->omap, hcode, match)
+                                    : hm_find(&index->hmap, hcode, match);
+    return node ? owner_of(node, member) : nullptr;
+}
+
+template <typename T, typename Eq>
+inline T *hi_take(HIndex *index, HNode T::*member, uint64_t hcode, Eq &&eq) {
+    auto match = [&](HNode *node) { return eq(owner_of(node, member)); };
+    HNode *node = g_open_addressing ? om_take(&index->omap, hcode, match)
+                                    : hm_take(&index->hmap, hcode, match);
+    return node ? owner_of(node, member) : nullptr;
+}
+
+/**
+ * `hm_find_shared()` and `hm_replace()`: the readers on other threads only
+ * know the chained table, `--shared-reads` rules out the other one
+ */
+template <typename T, typename Eq>
+inline T *hi_find_shared(HIndex *index, HNode T::*member, uint64_t hcode,
+                         Eq &&eq) {
+    assert(!g_open_addressing);
+    HNode *node = hm_find_shared(&index->hmap, hcode, [&](HNode *node) {
+        return eq(owner_of(node, member));
+    });
+    return node ? owner_of(node, member) : nullptr;
+}
+
+void hi_replace(HIndex *index, HNode *old, HNode *node);
+
+// `hm_find_batch()` or `om_find_batch()`, typed like `hi_find()`
+template <typename T, typename Eq>
+inline void hi_find_batch(HIndex *index, HNode T::*member,
+                          const uint64_t *hcodes, size_t n, Eq &&eq,
+                          T **out) {
+    auto match = [&](size_t i, HNode *node) {
+        return eq(i, owner_of(node, member));
+    };
+    assert(n <= K_PREFETCH_BATCH);
+    HNode *found[K_PREFETCH_BATCH];
+    if (g_open_addressing) {
+        om_find_batch(&index->omap, hcodes, n, match, found);
+    } else {
+        hm_find_batch(&index->hmap, hcodes, n, match, found);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = found[i] ? owner_of(found[i], member) : nullptr;
+    }
+}
+
+#endif /* OMAP_H */
@@ -0,0 +1,89 @@
+#ifndef PHASH_H
+#define PHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Compile-time perfect hashing of a fixed set of names
+ * - the hash is case-insensitive (ASCII)
+ * - the seed is searched at compile time until every name gets its own slot
+ * - a lookup is one hash and one table load; the caller still compares the
+ *   name since an unknown word can land on an occupied slot
+ */
+constexpr uint32_t phash_str(std::string_view s, uint32_t seed) {
+    uint32_t h = 0x811C9DC5 ^ seed;
+    for (char c : s) {
+        uint8_t b = (uint8_t)c;
+        if (b >= 'A' && b <= 'Z') {
+            b += 'a' - 'A';
+        }
+        h = (h ^ b) * 0x01000193;
+    }
+    // final mix so the low bits depend on every byte
+    h ^= h >> 15;
+    h *= 0x2C1B3C6D;
+    h ^= h >> 12;
+    return h;
+}
+
+constexpr size_t phash_slots(size_t n) {
+    size_t slots = 1;
+    while (slots < 2 * n) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+template <size_t N> struct PerfectHash {
+    static constexpr size_t K_SLOTS = phash_slots(N);
+
+    uint32_t seed = 0;
+    int16_t slots[K_SLOTS] = {}; // index of the name, -1 if empty
+
+    /**
+     * Returns the only candidate index for `s`, or -1
+     */
+    constexpr int32_t find(std::string_view s) const {
+        return slots[phash_str(s, seed) & (K_SLOTS - 1)];
+    }
+};
+
+/**
+ * Build the table for `items[i].name`, fails to compile if the names
+ * are not unique (no seed can separate them)
+ */
+template <class T, size_t N>
+consteval PerfectHash<N> phash_build(const T (&items)[N]) {
+    static_assert(N < 0x7FFF);
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (phash_str(items[i].name, 0) == phash_str(items[j].name, 0) &&
+                phash_str(items[i].name, 1) == phash_str(items[j].name, 1)) {
+                throw "duplicated name";
+            }
+        }
+    }
+
+    PerfectHash<N> ph;
+    for (uint32_t seed = 0;; ++seed) {
+        ph.seed = seed;
+        for (int16_t &slot : ph.slots) {
+            slot = -1;
+        }
+
+        bool ok = true;
+        for (size_t i = 0; ok && i < N; ++i) {
+            int16_t &slot = ph.slots[phash_str(items[i].name, seed) &
+                                     (PerfectHash<N>::K_SLOTS - 1)];
+            ok = slot < 0;
+            slot = (int16_t)i;
+        }
+        if (ok) {
+            return ph;
+        }
+    }
+}
+
+#endif /* PHASH_H */
@@ -1,28 +1,48 @@
+#include "art.h"
 #include "avl.h"
+#include "buffer.h"
 #include "constants.h"
+#include "ebr.h"
+#include "hash.h"
 #include "hashtable.h"
+#include "keyspace.h"
 #include "list.h"
+#include "lz.h"
+#include "mailbox.h"
+#include "omap.h"
+#include "phash.h"
+#include "shm.h"
+#include "slab.h"
 #include "thread_pool.h"
+#include "uring.h"
 #include "utils.h"
 #include "zset.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <array>
+#include <atomic>
 #include <bits/types/struct_timespec.h>
 #include <cassert>
+#include <charconv>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <errno.h>
 #include <map>
+#include <new>
 #include <netinet/ip.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <string_view>
+#include <sys/epoll.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 #include <vector>
@@ -98,6 +118,7 @@ enum {
     STATE_REQ = 0,
     STATE_RES = 1,
     STATE_END = 2, // mark the connection for deletion
+    STATE_WAIT = 3, // waiting for the reply of another shard
 };
 
 enum {
@@ -105,21 +126,40 @@ enum {
     T_ZSET = 1,
 };
 
+// where the bytes of a string value are
+enum {
+    ENC_INLINE = 0, // after the key, in the `Entry`
+    ENC_HEAP = 1,   // `Entry::heap`
+    ENC_INT = 2,    // `Entry::ival`, a string that reads as an int64
+    ENC_LZ = 3,     // `Entry::heap`, the length then an `lz.h` block
+};
+
+// the decimal text of any int64, see `int_str()`
+const size_t K_INT_STR = 24;
+
 struct Conn {
     int fd = -1;
     uint32_t state = STATE_REQ; /* either STATE_REQ or STATE_RES */
 
     // buffer for reading
-    size_t rbuf_size = 0;
-    uint8_t rbuf[4 + K_MAX_MSG]{};
+    Buffer rbuf;
 
     // buffer for writing
-    size_t wbuf_size = 0;
+    // responses of pipelined requests are appended back-to-back
+    Buffer wbuf;
     size_t wbuf_sent = 0;
-    uint8_t wbuf[4 + K_MAX_MSG]{};
 
     uint64_t idle_start = 0;
     DList idle_list; /* timer */
+
+    // epoll backend: events currently registered
+    uint32_t events = 0;
+    // io_uring backend: a recv or send is in flight on `rbuf`/`wbuf`
+    bool io_pending = false;
+    // multi-reactor: the command was forwarded to another shard
+    bool msg_pending = false;
+    // shared-memory transport, `fd` is then its eventfd
+    ShmChan *shm = nullptr;
 };
 
 /**
@@ -128,19 +168,38 @@ struct Conn {
 struct HeapItem {
     uint64_t val = 0;
     // `ref` points to the `Entry`
-    size_t *ref = nullptr;
+    uint32_t *ref = nullptr;
 };
 
-struct Entry {
-    struct HNode node;
-    std::string key;
-    std::string val;
-    uint32_t type = 0;
-    ZSet *zset = nullptr;
+// `Entry::heap_idx` of a key without TTL
+const uint32_t K_NO_TTL = UINT32_MAX;
 
+/**
+ * A key and its value in a single allocation (`entry_new()`): this header,
+ * the key bytes, then the bytes of a short string value
+ * - `type` tells which member of the union is used; a string is inline if
+ *   it fits in `vcap`, otherwise on the heap, unless it is the exact text of
+ *   an int64: then it is the number itself (`ENC_INT`)
+ * - the deadline of a TTL only lives in `g_data.heap`, the entry just knows
+ *   the position of its item there
+ */
+struct Entry {
+    union {
+        char *heap = nullptr; // T_STR, ENC_HEAP or ENC_LZ
+        int64_t ival;         // T_STR, ENC_INT
+        ZSet *zset;           // T_ZSET
+    };
+    uint32_t vlen = 0; // T_STR, ENC_INLINE or ENC_HEAP; `heap` for ENC_LZ
     // for TTLs
     // index of the corresponding `HeapItem`
-    size_t heap_idx = -1;
+    uint32_t heap_idx = K_NO_TTL;
+    uint8_t type = T_STR;
+    uint8_t enc = ENC_INLINE;
+    uint8_t vcap = 0; // bytes reserved after the key for an inline value
+    // for `--maxmemory`, see `entry_touch()`
+    uint8_t lfu = K_LFU_INIT; // logarithmic access counter
+    uint32_t atime = 0;       // `lru_clock()` of the last access
+    KNode node; // last, the key bytes follow (`--keyspace` engine)
 };
 
 static size_t heap_parent(size_t i) { return (i + 1) / 2 - 1; }
@@ -152,12 +211,12 @@ static void heap_bubble_up(HeapItem *ptr, size_t pos) {
     while (pos > 0 && ptr[heap_parent(pos)].val > item.val) {
         // swap with the parent
         ptr[pos] = ptr[heap_parent(pos)];
-        *(ptr[pos].ref) = pos;
+        *(ptr[pos].ref) = (uint32_t)pos;
         pos = heap_parent(pos);
     }
 
     ptr[pos] = item;
-    *(ptr[pos].ref) = pos;
+    *(ptr[pos].ref) = (uint32_t)pos;
 }
 
 static void heap_bubble_down(HeapItem *ptr, size_t pos, size_t len) {
@@ -183,12 +242,12 @@ static void heap_bubble_down(HeapItem *ptr, size_t pos, size_t len) {
         }
         // swap with the child
         ptr[pos] = ptr[min_pos];
-        *(ptr[pos].ref) = pos;
+        *(ptr[pos].ref) = (uint32_t)pos;
         pos = min_pos;
     }
 
     ptr[pos] = item;
-    *(ptr[pos].ref) = pos;
+    *(ptr[pos].ref) = (uint32_t)pos;
 }
 
 void heap_update(HeapItem *ptr, size_t pos, size_t len) {
@@ -199,6 +258,19 @@ void heap_update(HeapItem *ptr, size_t pos, size_t len) {
     }
 }
 
+/*
+ * `read()`/`write()` for sockets, or the rings of the shared-memory transport
+ */
+static ssize_t conn_read(Conn *conn, void *buf, size_t len) {
+    return conn->shm ? shm_chan_read(conn->shm, buf, len)
+                     : read(conn->fd, buf, len);
+}
+
+static ssize_t conn_write(Conn *conn, const void *buf, size_t len) {
+    return conn->shm ? shm_chan_write(conn->shm, buf, len)
+                     : write(conn->fd, buf, len);
+}
+
 /*
  * Flushes the write buffer until `EAGAIN` is returned;
  * or transits back to `STATE_REQ` if the flushing is done
@@ -206,8 +278,8 @@ void heap_update(HeapItem *ptr, size_t pos, size_t len) {
 static bool try_flush_buffer(Conn *conn) {
     ssize_t rv{};
     do {
-        size_t remaining = conn->wbuf_size - conn->wbuf_sent;
-        rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remaining);
+        size_t remaining = conn->wbuf.size - conn->wbuf_sent;
+        rv = conn_write(conn, &conn->wbuf.data[conn->wbuf_sent], remaining);
     } while (rv < 0 && errno == EINTR);
 
     if (rv < 0 && errno == EAGAIN) {
@@ -221,12 +293,13 @@ static bool try_flush_buffer(Conn *conn) {
     }
 
     conn->wbuf_sent += (size_t)rv;
-    assert(conn->wbuf_sent <= conn->wbuf_size);
-    if (conn->wbuf_sent == conn->wbuf_size) {
+    assert(conn->wbuf_sent <= conn->wbuf.size);
+    if (conn->wbuf_sent == conn->wbuf.size) {
         // response fully sent, change state back
         conn->state = STATE_REQ;
         conn->wbuf_sent = 0;
-        conn->wbuf_size = 0;
+        conn->wbuf.size = 0;
+        buf_release(&conn->wbuf);
         return false;
     }
 
@@ -241,16 +314,118 @@ static void state_res(Conn *conn) {
 }
 
 static std::map<std::string, std::string> g_map{};
-static struct {
-    HMap db;
+/**
+ * TCP uses one `SO_REUSEPORT` socket per reactor,
+ * the Unix sockets are created once and shared by all the reactors
+ */
+struct Listener {
+    int fd = -1;
+    bool shm = false; // the connections use the shared-memory transport
+};
+
+// a key sampled for `--maxmemory`, see `evict_pick()`
+struct EvictCand {
+    std::string key;
+    uint64_t score = 0; // `evict_score()` when sampled
+};
+
+/**
+ * State of one reactor (event loop thread)
+ * Shared-nothing: each reactor owns its connections and its shard of the
+ * keyspace, other reactors only talk to it through its `Mailbox`
+ */
+static thread_local struct {
+    uint32_t shard = 0; /* index of this reactor */
+    Keyspace db;
     std::vector<Conn *>
         fd2conn;                /* map of all client connections, keyed by fd */
     DList idle_list;            /* Timers for idle connections */
     std::vector<HeapItem> heap; /* timers for TTLs */
-    // thread pool
-    ThreadPool tp;
+    std::vector<std::string_view> cmd; /* arguments of the current request */
+    int epfd = -1; /* epoll instance watching the listeners and all conns */
+    std::vector<Listener> listeners;
+    URing ring;    /* io_uring backend, `ring.fd < 0` when unused */
+    uint64_t rehash_next_us = 0; /* next migration step of a `db` resize */
+    Keyspace *read_db = nullptr; /* another shard's `db`, see `CMD_SHARED` */
+    uint32_t lru_clock = 0; /* `lru_clock()` as of this loop iteration */
+    uint64_t rng = 0;       /* `rand_next()` */
+    std::vector<uint8_t> lz_buf; /* `entry_store_lz()` output */
+    bool oom = false; /* over `--maxmemory` with nothing left to evict */
+    std::vector<EvictCand> evict_pool; /* by `score`, the best last */
 } g_data;
 
+// thread pool, shared by all reactors
+static ThreadPool g_tp;
+// one per reactor, for the commands forwarded between shards
+static std::vector<Mailbox> g_mailboxes;
+// `--shared-reads`: the `db` of every reactor, null until it started
+static std::vector<std::atomic<Keyspace *>> g_dbs;
+
+static void stat_add(std::atomic<uint64_t> &counter, uint64_t n) {
+    // single writer, no need for an atomic read-modify-write
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+}
+
+/**
+ * Memory of a shard by category, for `memory stats`, as `slab_allocated()`
+ * counts it; written by its reactor only, read from any
+ * - the entries and their values change with them (`mem_add()`)
+ * - the other ones are read off their structures once per loop iteration
+ *   (`mem_publish()`), in O(1)
+ * `dataset` is the bytes of the keys and values themselves: the member
+ * names and 8 bytes per score of a sorted set, 8 bytes for an `ENC_INT`,
+ * the compressed bytes of an `ENC_LZ`
+ */
+struct MemStats {
+    std::atomic<uint64_t> keys{0};
+    std::atomic<uint64_t> entries{0}; // headers, keys and inline values
+    std::atomic<uint64_t> strings{0}; // the values not inline
+    std::atomic<uint64_t> zsets{0};   // `ZSet`, nodes and tables
+    std::atomic<uint64_t> dataset{0};
+    std::atomic<uint64_t> keyspace{0}; // the index, see `ks_mem_usage()`
+    std::atomic<uint64_t> ttl_heap{0};
+    std::atomic<uint64_t> buffers{0}; // connection buffers and their pool
+    // `--compress`: the `ENC_LZ` values, their length and their allocations
+    std::atomic<uint64_t> lz_values{0};
+    std::atomic<uint64_t> lz_raw{0};
+    std::atomic<uint64_t> lz_stored{0};
+};
+
+// one per reactor
+static std::vector<MemStats> g_mem;
+
+// `--maxmemory-policy`, which keys to evict
+enum {
+    EVICT_NONE = 0,      // noeviction: refuse the writes that may grow
+    EVICT_ALL_LRU = 1,   // allkeys-lru
+    EVICT_ALL_LFU = 2,   // allkeys-lfu
+    EVICT_TTL_LRU = 3,   // volatile-lru: only the keys with a TTL
+    EVICT_TTL_LFU = 4,   // volatile-lfu
+};
+
+static const char *const k_evict_names[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "volatile-lru", "volatile-lfu",
+};
+
+static struct {
+    bool io_uring = false;      /* --io-uring */
+    uint32_t threads = 1;       /* --threads, number of reactors and shards */
+    size_t max_msg = K_MAX_MSG; /* --max-msg, max request/response size */
+    const char *unix_path = nullptr; /* --unix, Unix socket listener */
+    const char *shm_path = nullptr;  /* --shm, shared-memory transport */
+    uint32_t max_clients = K_MAX_CLIENTS; /* --max-clients, 0 is unlimited */
+    const KeyspaceEngine *keyspace = nullptr; /* --keyspace */
+    bool shared_reads = false; /* --shared-reads, see `CMD_SHARED` */
+    size_t maxmemory = 0; /* --maxmemory, 0 is unlimited */
+    uint32_t evict = EVICT_NONE; /* --maxmemory-policy */
+    size_t compress = 0; /* --compress, 0 is off, see `entry_store_lz()` */
+    bool verbose = false; /* --verbose, print every request */
+} g_opts;
+
+// connections open on all reactors, checked against `--max-clients`
+static std::atomic<uint32_t> g_nclients{0};
+
 static uint64_t get_monotonic_usec() {
     timespec tv{0, 0};
     clock_gettime(CLOCK_MONOTONIC, &tv);
@@ -262,7 +437,7 @@ static uint64_t get_monotonic_usec() {
  * set or remove TTL
  */
 static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
-    if (ttl_ms < 0 && ent->heap_idx != (size_t)-1) {
+    if (ttl_ms < 0 && ent->heap_idx != K_NO_TTL) {
         // erase the item from the heap
         // by replacing it with the last item in the array
         size_t pos = ent->heap_idx;
@@ -271,10 +446,10 @@ static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
         if (pos < g_data.heap.size()) {
             heap_update(g_data.heap.data(), pos, g_data.heap.size());
         }
-        ent->heap_idx = -1;
+        ent->heap_idx = K_NO_TTL;
     } else if (ttl_ms >= 0) {
         size_t pos = ent->heap_idx;
-        if (pos == (size_t)-1) {
+        if (pos == K_NO_TTL) {
             // add new item to the heap
             HeapItem item;
             item.ref = &ent->heap_idx;
@@ -287,50 +462,425 @@ static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
     }
 }
 
+// the arguments are not NUL-terminated, `std::from_chars` takes a range
+static bool str2double(std::string_view s, double &out) {
+    const char *end = s.data() + s.size();
+    auto [ptr, ec] = std::from_chars(s.data(), end, out);
+    return ec == std::errc() && ptr == end && !std::isnan(out);
+}
+
+static bool str2int(std::string_view s, int64_t &out) {
+    const char *end = s.data() + s.size();
+    auto [ptr, ec] = std::from_chars(s.data(), end, out);
+    return ec == std::errc() && ptr == end;
+}
+
+// `buf` has `K_INT_STR` bytes
+static std::string_view int_str(int64_t val, char *buf) {
+    char *end = std::to_chars(buf, buf + K_INT_STR, val).ptr;
+    return std::string_view(buf, (size_t)(end - buf));
+}
+
+/**
+ * `val` is exactly what `int_str()` gives for some int64: no sign, leading
+ * zero or space the number would lose, `get` returns the same bytes
+ */
+static bool str_is_int(std::string_view val, int64_t &out) {
+    char buf[K_INT_STR];
+    return val.size() < K_INT_STR && str2int(val, out) &&
+           int_str(out, buf) == val;
+}
+
+// the `vlen` of `entry_new()`, nothing is inline for an `ENC_INT`
+static size_t str_vlen(std::string_view val) {
+    int64_t ival = 0;
+    return str_is_int(val, ival) ? 0 : val.size();
+}
+
+/**
+ * Access metadata for `--maxmemory`, in the padding of the `Entry` header
+ * - `atime`: the clock of the last access, `K_LRU_CLOCK_MS` ticks that wrap
+ *   around after a year and a half; read once per loop iteration
+ * - `lfu`: a logarithmic counter of the accesses, an access increments it
+ *   with a probability falling as it grows; it loses 1 per `K_LFU_DECAY_MS`
+ *   of idle time, so a key once hot cools down
+ */
+static uint32_t lru_clock() {
+    return (uint32_t)(get_monotonic_usec() / 1000 / K_LRU_CLOCK_MS);
+}
+
+// splitmix64, per thread
+static uint64_t rand_next() {
+    uint64_t z = (g_data.rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * `atime` and `lfu` are written by the reads of other reactors too
+ * (`--shared-reads`), relaxed: a lost update only skews the next eviction
+ */
+static uint32_t entry_atime(Entry *ent) {
+    return std::atomic_ref<uint32_t>(ent->atime).load(
+        std::memory_order_relaxed);
+}
+
+static uint64_t entry_idle_ms(Entry *ent) {
+    return (uint64_t)(uint32_t)(g_data.lru_clock - entry_atime(ent)) *
+           K_LRU_CLOCK_MS;
+}
+
+// `lfu` with the decay of the idle time applied
+static uint8_t entry_lfu(Entry *ent) {
+    uint64_t decay = entry_idle_ms(ent) / K_LFU_DECAY_MS;
+    uint8_t lfu =
+        std::atomic_ref<uint8_t>(ent->lfu).load(std::memory_order_relaxed);
+    return decay < lfu ? (uint8_t)(lfu - decay) : 0;
+}
+
+static bool evict_lfu() {
+    return g_opts.evict == EVICT_ALL_LFU || g_opts.evict == EVICT_TTL_LFU;
+}
+
+// a read or write of the entry
+static void entry_touch(Entry *ent) {
+    if (g_opts.evict == EVICT_NONE) {
+        return;
+    }
+    if (evict_lfu()) {
+        uint8_t counter = entry_lfu(ent);
+        uint32_t base = counter > K_LFU_INIT ? counter - K_LFU_INIT : 0;
+        // incremented with the probability 1 / (base * factor + 1)
+        if (counter < 255 &&
+            rand_next() % (base * K_LFU_LOG_FACTOR + 1) == 0) {
+            counter++;
+        }
+        std::atomic_ref<uint8_t>(ent->lfu).store(counter,
+                                                 std::memory_order_relaxed);
+    }
+    std::atomic_ref<uint32_t>(ent->atime).store(g_data.lru_clock,
+                                                std::memory_order_relaxed);
+}
+
+/**
+ * A new entry for `key`, `vlen` tells if a string value will be inline
+ * A value of up to `K_INLINE_VAL_MAX` bytes is, with the slack of the
+ * allocation rounded up to the 16 bytes of a slab size class: a later value
+ * of that size stays inline
+ */
+static Entry *entry_new(std::string_view key, size_t vlen) {
+    size_t size = offsetof(Entry, node) + offsetof(KNode, key) + key.size();
+    size_t vcap = 0;
+    if (vlen <= K_INLINE_VAL_MAX) {
+        vcap = std::min(((size + vlen + 15) & ~(size_t)15) - size,
+                        K_INLINE_VAL_MAX);
+    }
+    Entry *ent = new (slab_alloc(size + vcap)) Entry();
+    ent->vcap = (uint8_t)vcap;
+    ent->atime = g_data.lru_clock;
+    ent->node.klen = (uint32_t)key.size();
+    memcpy(ent->node.key, key.data(), key.size());
+    return ent;
+}
+
+// as allocated by `entry_new()`
+static size_t entry_size(Entry *ent) {
+    return offsetof(Entry, node) + offsetof(KNode, key) + ent->node.klen +
+           ent->vcap;
+}
+
+/**
+ * What the entry holds, by category of `MemStats`
+ */
+struct EntryMem {
+    size_t entry = 0;   // the allocation of `entry_new()`
+    size_t string = 0;  // a string value not inline
+    size_t zset = 0;    // a sorted set, `zset_mem()`
+    size_t dataset = 0; // the key and value bytes
+    size_t lz_raw = 0;  // `ENC_LZ`: the length of the value
+};
+
+static EntryMem entry_mem_parts(Entry *ent) {
+    EntryMem m;
+    m.entry = slab_size(entry_size(ent));
+    m.dataset = ent->node.klen;
+    if (ent->type == T_ZSET) {
+        m.zset = zset_mem(ent->zset);
+        m.dataset += ent->zset->names + hi_size(&ent->zset->hmap) * 8;
+    } else if (ent->enc == ENC_INT) {
+        m.dataset += sizeof(ent->ival);
+    } else if (ent->enc == ENC_LZ) {
+        m.string = slab_size(ent->vlen);
+        m.dataset += ent->vlen - 4;
+        uint32_t len = 0;
+        memcpy(&len, ent->heap, 4);
+        m.lz_raw = len;
+    } else {
+        m.string = ent->enc == ENC_HEAP ? slab_size(ent->vlen) : 0;
+        m.dataset += ent->vlen;
+    }
+    return m;
+}
+
+// what freeing the entry gives back, as `slab_allocated()` counts it
+static size_t entry_mem(Entry *ent) {
+    EntryMem m = entry_mem_parts(ent);
+    return m.entry + m.string + m.zset;
+}
+
+/**
+ * Count the entry in `g_mem` (`sign` 1) once it is in the keyspace, and
+ * out (-1) when it leaves it; a change of its value in between is counted
+ * as going out then in again
+ */
+static void mem_add(Entry *ent, int64_t sign) {
+    MemStats &mem = g_mem[g_data.shard];
+    EntryMem m = entry_mem_parts(ent);
+    stat_add(mem.keys, (uint64_t)sign);
+    stat_add(mem.entries, (uint64_t)(sign * (int64_t)m.entry));
+    stat_add(mem.strings, (uint64_t)(sign * (int64_t)m.string));
+    stat_add(mem.zsets, (uint64_t)(sign * (int64_t)m.zset));
+    stat_add(mem.dataset, (uint64_t)(sign * (int64_t)m.dataset));
+    if (m.lz_raw) {
+        stat_add(mem.lz_values, (uint64_t)sign);
+        stat_add(mem.lz_raw, (uint64_t)(sign * (int64_t)m.lz_raw));
+        stat_add(mem.lz_stored, (uint64_t)(sign * (int64_t)m.string));
+    }
+}
+
+static char *entry_inline(Entry *ent) {
+    return ent->node.key + ent->node.klen;
+}
+
+static void entry_heap_free(Entry *ent) {
+    if (ent->enc == ENC_HEAP || ent->enc == ENC_LZ) {
+        slab_free(ent->heap, ent->vlen);
+    }
+}
+
+// T_STR but `ENC_LZ`; `buf` (`K_INT_STR` bytes) holds the text of an
+// `ENC_INT`
+static std::string_view entry_str(Entry *ent, char *buf) {
+    assert(ent->enc != ENC_LZ);
+    switch (ent->enc) {
+    case ENC_INT:
+        return int_str(ent->ival, buf);
+    case ENC_HEAP:
+        return std::string_view(ent->heap, ent->vlen);
+    default:
+        return std::string_view(entry_inline(ent), ent->vlen);
+    }
+}
+
+// a new entry, or a string one
+static void entry_store_int(Entry *ent, int64_t val) {
+    entry_heap_free(ent);
+    ent->ival = val;
+    ent->enc = ENC_INT;
+    ent->vlen = 0;
+}
+
+/**
+ * `--compress`: a value of at least that many bytes, and not inline, is
+ * kept compressed if that saves 1/8 of it or more; the length of the value
+ * comes first, then the block
+ */
+static bool entry_store_lz(Entry *ent, std::string_view val) {
+    if (!g_opts.compress || val.size() < g_opts.compress) {
+        return false;
+    }
+    std::vector<uint8_t> &buf = g_data.lz_buf;
+    size_t cap = val.size() - val.size() / 8;
+    if (buf.size() < cap) {
+        buf.resize(cap);
+    }
+    size_t n =
+        lz_compress((const uint8_t *)val.data(), val.size(), buf.data(), cap);
+    if (!n) {
+        return false;
+    }
+    uint32_t len = (uint32_t)val.size();
+    ent->vlen = (uint32_t)(4 + n);
+    ent->heap = (char *)slab_alloc(ent->vlen);
+    memcpy(ent->heap, &len, 4);
+    memcpy(ent->heap + 4, buf.data(), n);
+    ent->enc = ENC_LZ;
+    return true;
+}
+
+// a new entry, or a string one; `val` is not in the entry
+static void entry_store_str(Entry *ent, std::string_view val) {
+    int64_t ival = 0;
+    if (str_is_int(val, ival)) {
+        return entry_store_int(ent, ival);
+    }
+    entry_heap_free(ent);
+    if (val.size() > ent->vcap && entry_store_lz(ent, val)) {
+        return;
+    }
+    if (val.size() > ent->vcap) {
+        ent->heap = (char *)slab_alloc(val.size());
+        memcpy(ent->heap, val.data(), val.size());
+        ent->enc = ENC_HEAP;
+        ent->vlen = (uint32_t)val.size();
+    } else {
+        memcpy(entry_inline(ent), val.data(), val.size());
+        ent->enc = ENC_INLINE;
+        ent->vlen = (uint32_t)val.size();
+    }
+}
+
 /**
  * Deallocate the key immediately
  */
 static void entry_destroy(Entry *ent) {
     switch (ent->type) {
+    case T_STR:
+        entry_heap_free(ent);
+        break;
     case T_ZSET:
         zset_dispose(ent->zset);
-        delete ent->zset;
+        ent->zset->~ZSet();
+        slab_free(ent->zset, sizeof(ZSet));
         break;
     }
-    delete ent;
+    slab_free(ent, entry_size(ent));
 }
 
 static void entry_del_async(void *arg) { entry_destroy((Entry *)arg); }
 
 /**
- * Dispose the entry after it got attached from the key space
- * Remove the possible TTL timer when deleting an Entry
  * Put the destruction of large sorted sets into the thread pool
  *   - thread pool is _only_ for the large ones since multi-threading has some
  * overheads too
  */
-static void entry_del(Entry *ent) {
-    entry_set_ttl(ent, -1);
+static void entry_dispose(void *arg) {
+    Entry *ent = (Entry *)arg;
     const size_t k_large_container_size = 10000;
     bool too_big = false;
 
     switch (ent->type) {
     case T_ZSET:
-        too_big = hm_size(&ent->zset->hmap) > k_large_container_size;
+        too_big = hi_size(&ent->zset->hmap) > k_large_container_size;
         break;
     }
 
     if (too_big) {
-        thread_pool_queue(&g_data.tp, &entry_del_async, ent);
+        thread_pool_queue(&g_tp, &entry_del_async, ent);
     } else {
         entry_destroy(ent);
     }
 }
 
-static bool entry_eq(HNode *lhs, HNode *rhs) {
-    struct Entry *le = container_of(lhs, struct Entry, node);
-    struct Entry *re = container_of(rhs, struct Entry, node);
-    return lhs->hcode == rhs->hcode && le->key == re->key;
+/**
+ * Dispose the entry after it got attached from the key space
+ * Remove the possible TTL timer when deleting an Entry
+ * With `--shared-reads`, once the readers of other reactors are done
+ */
+static void entry_del(Entry *ent) {
+    mem_add(ent, -1);
+    entry_set_ttl(ent, -1);
+    ebr_retire(ent, &entry_dispose, entry_mem(ent));
+}
+
+static void db_detach(Entry *ent);
+static void db_reinsert(Entry *ent);
+
+/**
+ * `set` on an existing key of any type, the TTL is kept
+ * A string is changed in place; otherwise a new entry takes the place of
+ * the old one, which goes like a deleted one
+ * `--shared-reads`: a value is not changed in place under the readers of
+ * other reactors, the entry is always swapped
+ */
+static void entry_set_val(Entry *ent, std::string_view val) {
+    if (!g_opts.shared_reads && ent->type == T_STR) {
+        mem_add(ent, -1);
+        entry_store_str(ent, val);
+        mem_add(ent, 1);
+        return;
+    }
+
+    Entry *copy = entry_new(knode_key(&ent->node), str_vlen(val));
+    entry_store_str(copy, val);
+    copy->lfu =
+        std::atomic_ref<uint8_t>(ent->lfu).load(std::memory_order_relaxed);
+    copy->heap_idx = ent->heap_idx;
+    if (copy->heap_idx != K_NO_TTL) {
+        g_data.heap[copy->heap_idx].ref = &copy->heap_idx;
+        ent->heap_idx = K_NO_TTL;
+    }
+    if (g_opts.shared_reads) {
+        g_data.db.engine->replace(&g_data.db, &ent->node, &copy->node);
+        mem_add(copy, 1);
+    } else {
+        db_detach(ent);
+        db_reinsert(copy);
+    }
+    // no TTL left to it
+    entry_del(ent);
+}
+
+static void znode_retire(void *arg) { znode_del((ZNode *)arg); }
+
+static Entry *entry_of(KNode *node) {
+    return node ? container_of(node, Entry, node) : nullptr;
+}
+
+/**
+ * The keyspace, `g_data.db`, through the engine picked by `--keyspace`
+ * `lk` holds the probed key without materializing an `Entry`
+ */
+static void lookup_key_init(LookupKey *lk, std::string_view key) {
+    ks_key_init(&g_data.db, lk, key);
+}
+
+static Entry *db_lookup(LookupKey *lk) {
+    Entry *ent = entry_of(ks_lookup(&g_data.db, lk));
+    if (ent) {
+        entry_touch(ent);
+    }
+    return ent;
+}
+
+/**
+ * `ent` is new, `lk` is the key it was not found with
+ */
+static void db_insert(Entry *ent, LookupKey *lk) {
+    KNode *dup = ks_upsert(&g_data.db, lk, &ent->node);
+    assert(!dup);
+    (void)dup;
+    mem_add(ent, 1);
+}
+
+// `ent` takes the place of the one of the same key just detached
+static void db_reinsert(Entry *ent) {
+    LookupKey lk;
+    lookup_key_init(&lk, knode_key(&ent->node));
+    db_insert(ent, &lk);
+}
+
+static Entry *db_pop(LookupKey *lk) {
+    return entry_of(ks_pop(&g_data.db, lk));
+}
+
+static void db_detach(Entry *ent) { ks_detach(&g_data.db, &ent->node); }
+
+static size_t db_size() { return ks_size(&g_data.db); }
+
+static Entry *entry_lookup(std::string_view key) {
+    LookupKey lk;
+    lookup_key_init(&lk, key);
+    if (g_data.read_db) {
+        Entry *ent = entry_of(
+            g_data.read_db->engine->lookup_shared(g_data.read_db, &lk));
+        if (ent) {
+            entry_touch(ent);
+        }
+        return ent;
+    }
+    return db_lookup(&lk);
 }
 
 // static uint32_t do_get(const std::vector<std::string> &cmd, uint8_t *res,
@@ -346,20 +896,38 @@ static bool entry_eq(HNode *lhs, HNode *rhs) {
 //     return RES_OK;
 // }
 
-static void do_get(std::vector<std::string> &cmd, std::string &out) {
-    Entry entry;
-    entry.key.swap(cmd[1]); // set cmd[1] to be the key in entry
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
+/**
+ * The string value of `ent` into the response; an `ENC_LZ` one is
+ * decompressed right into it
+ */
+static void out_entry_str(Buffer &out, Entry *ent) {
+    if (ent->enc != ENC_LZ) {
+        char buf[K_INT_STR];
+        std::string_view val = entry_str(ent, buf);
+        return out_str(out, val.data(), val.size());
+    }
+    uint32_t len = 0;
+    memcpy(&len, ent->heap, 4);
+    out_reserve(out, 1 + 4 + len);
+    out.data[out.size] = SER_STR;
+    memcpy(&out.data[out.size + 1], &len, 4);
+    bool ok = lz_decompress((const uint8_t *)ent->heap + 4, ent->vlen - 4,
+                            &out.data[out.size + 1 + 4], len);
+    assert(ok);
+    (void)ok;
+    out.size += 1 + 4 + len;
+}
 
-    HNode *node = hm_lookup(&g_data.db, &entry.node, &entry_eq);
-    if (!node) {
+static void do_get(std::vector<std::string_view> &cmd, Buffer &out) {
+    Entry *ent = entry_lookup(cmd[1]);
+    if (!ent) {
         return out_nil(out);
     }
 
-    const std::string &val = container_of(node, Entry, node)->val;
-    assert(val.size() <= K_MAX_MSG);
-
-    out_str(out, val);
+    if (ent->type != T_STR) {
+        return out_err(out, ERR_TYPE, "expecting string");
+    }
+    out_entry_str(out, ent);
 }
 
 /* static uint32_t do_set(const std::vector<std::string> &cmd, uint8_t *res,
@@ -369,23 +937,22 @@ static void do_get(std::vector<std::string> &cmd, std::string &out) {
     g_map[cmd[1]] = cmd[2];
     return RES_OK;
 } */
-static void do_set(std::vector<std::string> &cmd, std::string &out) {
-    Entry entry;
-    entry.key.swap(cmd[1]);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
-
-    HNode *node = hm_lookup(&g_data.db, &entry.node, &entry_eq);
-    if (node) {
+static void db_set(LookupKey *lk, std::string_view val) {
+    Entry *ent = db_lookup(lk);
+    if (ent) {
         // node already exists
-        container_of(node, Entry, node)->val.swap(cmd[2]);
+        entry_set_val(ent, val);
     } else {
-        Entry *new_entry = new Entry();
-        new_entry->key.swap(entry.key);
-        new_entry->node.hcode = entry.node.hcode;
-        new_entry->val.swap(cmd[2]);
-        hm_insert(&g_data.db, &new_entry->node);
+        Entry *new_entry = entry_new(lk->key, str_vlen(val));
+        entry_store_str(new_entry, val);
+        db_insert(new_entry, lk);
     }
+}
 
+static void do_set(std::vector<std::string_view> &cmd, Buffer &out) {
+    LookupKey lk;
+    lookup_key_init(&lk, cmd[1]);
+    db_set(&lk, cmd[2]);
     return out_nil(out);
 }
 
@@ -397,20 +964,162 @@ static void do_set(std::vector<std::string> &cmd, std::string &out) {
     return RES_OK;
 } */
 
-static void do_del(std::vector<std::string> &cmd, std::string &out) {
-    Entry entry;
-    entry.key.swap(cmd[1]);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
+static void do_del(std::vector<std::string_view> &cmd, Buffer &out) {
+    LookupKey lk;
+    lookup_key_init(&lk, cmd[1]);
+
+    Entry *ent = db_pop(&lk);
+    if (ent) {
+        entry_del(ent);
+    }
+    return out_int(out, ent ? 1 : 0);
+}
+
+/**
+ * Add `delta` to the integer of `key`, a missing key being 0, and reply
+ * with the result
+ * The number is changed in place, except under the readers of other
+ * reactors (`--shared-reads`): then the entry is swapped like by `set`
+ */
+static void db_incr(std::string_view key, int64_t delta, Buffer &out) {
+    LookupKey lk;
+    lookup_key_init(&lk, key);
+    Entry *ent = db_lookup(&lk);
+    int64_t val = 0;
+    if (ent) {
+        if (ent->type != T_STR) {
+            return out_err(out, ERR_TYPE, "expecting string");
+        }
+        if (ent->enc != ENC_INT) {
+            return out_err(out, ERR_TYPE, "value is not an integer");
+        }
+        val = ent->ival;
+    }
+    if (__builtin_add_overflow(val, delta, &val)) {
+        return out_err(out, ERR_ARG, "increment or decrement would overflow");
+    }
+
+    if (!ent) {
+        ent = entry_new(lk.key, 0);
+        entry_store_int(ent, val);
+        db_insert(ent, &lk);
+    } else if (!g_opts.shared_reads) {
+        ent->ival = val;
+    } else {
+        char buf[K_INT_STR];
+        entry_set_val(ent, int_str(val, buf));
+    }
+    return out_int(out, val);
+}
+
+/**
+ * command: `incr <key>`, `decr <key>`
+ */
+static void do_incr(std::vector<std::string_view> &cmd, Buffer &out) {
+    return db_incr(cmd[1], 1, out);
+}
+
+static void do_decr(std::vector<std::string_view> &cmd, Buffer &out) {
+    return db_incr(cmd[1], -1, out);
+}
+
+/**
+ * command: `incrby <key> <delta>`, `decrby <key> <delta>`
+ */
+static void do_incrby(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t delta = 0;
+    if (!str2int(cmd[2], delta)) {
+        return out_err(out, ERR_ARG, "expecting int");
+    }
+    return db_incr(cmd[1], delta, out);
+}
+
+static void do_decrby(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t delta = 0;
+    if (!str2int(cmd[2], delta)) {
+        return out_err(out, ERR_ARG, "expecting int");
+    }
+    if (delta == INT64_MIN) {
+        return out_err(out, ERR_ARG, "increment or decrement would overflow");
+    }
+    return db_incr(cmd[1], -delta, out);
+}
+
+/**
+ * Multi-key commands: call `f(pos, lk, ent)` for the keys `cmd[1]`,
+ * `cmd[1 + step]`, ... in order, `K_PREFETCH_BATCH` of them being looked up
+ * together first (see `hm_find_batch()`)
+ * `ent` is what that lookup found; as `f` may write and a batch may hold
+ * the same key twice, the writes look their key up again, in cache by then
+ */
+template <typename F>
+static void db_batch(std::vector<std::string_view> &cmd, size_t step, F &&f) {
+    LookupKey lks[K_PREFETCH_BATCH];
+    KNode *found[K_PREFETCH_BATCH];
+    size_t pos = 1;
+    while (pos < cmd.size()) {
+        size_t n = 0;
+        for (size_t p = pos; n < K_PREFETCH_BATCH && p < cmd.size();
+             p += step, ++n) {
+            lookup_key_init(&lks[n], cmd[p]);
+        }
+        ks_lookup_batch(&g_data.db, lks, n, found);
+        for (size_t i = 0; i < n; ++i, pos += step) {
+            f(pos, &lks[i], entry_of(found[i]));
+        }
+    }
+}
+
+/**
+ * command: `mget <key>...`
+ * the values in order, nil for the missing keys
+ */
+static void do_mget(std::vector<std::string_view> &cmd, Buffer &out) {
+    out_arr(out, (uint32_t)(cmd.size() - 1));
+    db_batch(cmd, 1, [&](size_t, LookupKey *, Entry *ent) {
+        if (ent && ent->type == T_STR) {
+            entry_touch(ent);
+            out_entry_str(out, ent);
+        } else {
+            out_nil(out);
+        }
+    });
+}
 
-    HNode *node = hm_pop(&g_data.db, &entry.node, &entry_eq);
-    if (node) {
-        entry_del(container_of(node, Entry, node));
+/**
+ * command: `mset <key> <val> [<key> <val>]...`
+ */
+static void do_mset(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (cmd.size() % 2 != 1) {
+        return out_err(out, ERR_ARG, "wrong number of arguments");
     }
-    return out_int(out, node ? 1 : 0);
+    db_batch(cmd, 2, [&](size_t pos, LookupKey *lk, Entry *) {
+        db_set(lk, cmd[pos + 1]);
+    });
+    return out_nil(out);
+}
+
+/**
+ * command: `mdel <key>...`
+ * the number of keys deleted
+ */
+static void do_mdel(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t n = 0;
+    db_batch(cmd, 1, [&](size_t, LookupKey *lk, Entry *) {
+        Entry *ent = db_pop(lk);
+        if (ent) {
+            entry_del(ent);
+            n++;
+        }
+    });
+    return out_int(out, n);
 }
 
+/**
+ * The arguments are views into `data`, no copy is made
+ */
 static int32_t parse_req(const uint8_t *data, size_t len,
-                         std::vector<std::string> &out) {
+                         std::vector<std::string_view> &out) {
     if (len < 4) {
         return -1;
     }
@@ -431,7 +1140,7 @@ static int32_t parse_req(const uint8_t *data, size_t len,
         if (pos + 4 + sz > len) {
             return -1;
         }
-        out.push_back(std::string((char *)&data[pos + 4], sz));
+        out.push_back(std::string_view((char *)&data[pos + 4], sz));
         pos += 4 + sz;
     }
 
@@ -442,79 +1151,402 @@ static int32_t parse_req(const uint8_t *data, size_t len,
     return 0;
 }
 
-void cb_scan(HNode *node, void *arg) {
-    std::string &out = *(std::string *)arg;
-    out_str(out, container_of(node, Entry, node)->key);
-}
-
-static bool str2double(const std::string &s, double &out) {
-    char *endp = nullptr;
-    out = strtod(s.c_str(), &endp);
-    return endp == s.c_str() + s.size() && !std::isnan(out);
-}
-
-static bool str2int(const std::string &s, int64_t &out) {
-    char *endp = nullptr;
-    out = strtoll(s.c_str(), &endp, 10);
-    return endp == s.c_str() + s.size();
+static bool cb_walk_key(KNode *, std::string_view key, void *arg) {
+    out_str(*(Buffer *)arg, key.data(), key.size());
+    return true;
 }
 
-static void do_keys(std::vector<std::string> &cmd, std::string &out) {
+static void do_keys(std::vector<std::string_view> &cmd, Buffer &out) {
     (void)cmd;
-    out_arr(out, (uint32_t)hm_size(&g_data.db));
-    h_scan(&g_data.db.ht_to, &cb_scan, &out);
-    h_scan(&g_data.db.ht_from, &cb_scan, &out);
+    size_t n = db_size();
+    out_reserve(out, 1 + 4 + n * (1 + 4)); // the key bytes are not known yet
+    out_arr(out, (uint32_t)n);
+    ks_walk(&g_data.db, "", &cb_walk_key, &out);
 }
 
 /**
- * command: `zadd zset <score> <string>`
+ * `kprefix <prefix> [limit]`, `krange <start> <end> [limit]`
+ * The keys in order, from `start` up to `end` excluded ("" has no end)
+ * - an ordered engine (`--keyspace art`) walks from `start`, proportional
+ *   to the result
+ * - the others have to scan and sort the keys
+ * With `--threads`, each shard returns its first `limit` keys, which
+ * `gather_add()` merges in order (`CMD_SORTED`)
  */
-static void do_zadd(std::vector<std::string> &cmd, std::string &out) {
-    double score = 0;
-    if (!str2double(cmd[2], score)) {
-        return out_err(out, ERR_ARG, "expected fp number");
-    }
+struct KeyRange {
+    std::string_view start;
+    std::string_view end;
+    std::string_view prefix;
+    size_t limit = SIZE_MAX;
+    Buffer *out = nullptr;
+    uint32_t n = 0;
+    bool ordered = false; // see `KeyspaceEngine::ordered`
+    std::vector<std::string_view> keys; // to be sorted, if not `ordered`
+};
 
-    // lookup or create the zset
-    Entry entry;
-    entry.key.swap(cmd[1]);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
-    HNode *hnode = hm_lookup(&g_data.db, &entry.node, &entry_eq);
+static bool key_in_range(const KeyRange *kr, std::string_view key) {
+    return key.starts_with(kr->prefix) && key >= kr->start &&
+           (kr->end.empty() || key < kr->end);
+}
 
-    Entry *ent = nullptr;
-    if (!hnode) {
-        ent = new Entry();
-        ent->key.swap(entry.key);
-        ent->node.hcode = entry.node.hcode;
-        ent->type = T_ZSET;
-        ent->zset = new ZSet();
-        hm_insert(&g_data.db, &ent->node);
-    } else {
-        ent = container_of(hnode, Entry, node);
-        if (ent->type != T_ZSET) {
-            return out_err(out, ERR_TYPE, "expecting zset");
+static bool cb_range_key(KNode *, std::string_view key, void *arg) {
+    KeyRange *kr = (KeyRange *)arg;
+    if (!kr->ordered) {
+        if (key_in_range(kr, key)) {
+            kr->keys.push_back(key); // the key of the node, it stays
         }
+        return true;
     }
-
-    // add/update the tuple
-    const std::string &name = cmd[3];
-    bool added = zset_add(ent->zset, name.data(), name.size(), score);
-
-    return out_int(out, (int64_t)added);
+    if (!key_in_range(kr, key)) {
+        return false; // the keys are in order, all the next ones are past it
+    }
+    out_str(*kr->out, key.data(), key.size());
+    return ++kr->n < kr->limit;
 }
 
-static bool expect_zset(std::string &out, std::string &s, Entry **ent) {
-    Entry entry;
-    entry.key.swap(s);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
-    HNode *hnode = hm_lookup(&g_data.db, &entry.node, &entry_eq);
-
-    if (!hnode) {
+static void key_range_reply(KeyRange *kr, std::vector<std::string_view> &cmd,
+                            size_t nargs, Buffer &out) {
+    int64_t limit = 0;
+    if (cmd.size() > nargs + 1) {
+        return out_err(out, ERR_ARG, "syntax error");
+    }
+    if (cmd.size() == nargs + 1) {
+        if (!str2int(cmd[nargs], limit) || limit <= 0) {
+            return out_err(out, ERR_ARG, "expecting positive int");
+        }
+        kr->limit = (size_t)limit;
+    }
+
+    kr->out = &out;
+    kr->ordered = g_data.db.engine->ordered;
+    size_t arr = out_begin_arr(out);
+    ks_walk(&g_data.db, kr->start, &cb_range_key, kr);
+    if (!kr->ordered) {
+        std::sort(kr->keys.begin(), kr->keys.end());
+        for (std::string_view key : kr->keys) {
+            if (kr->n >= kr->limit) {
+                break;
+            }
+            out_str(out, key.data(), key.size());
+            kr->n++;
+        }
+    }
+    out_end_arr(out, arr, kr->n);
+}
+
+static void do_kprefix(std::vector<std::string_view> &cmd, Buffer &out) {
+    KeyRange kr;
+    kr.start = kr.prefix = cmd[1];
+    key_range_reply(&kr, cmd, 2, out);
+}
+
+static void do_krange(std::vector<std::string_view> &cmd, Buffer &out) {
+    KeyRange kr;
+    kr.start = cmd[1];
+    kr.end = cmd[2];
+    key_range_reply(&kr, cmd, 3, out);
+}
+
+/**
+ * `scan <cursor> [match <pattern>] [count <n>]`
+ * `zscan <zset> <cursor> [match <pattern>] [count <n>]`
+ */
+struct ScanArgs {
+    uint64_t cursor = 0;
+    std::string_view match; // empty: no filtering
+    size_t count = 10;      // nodes to examine, roughly
+};
+
+static bool parse_scan_args(std::vector<std::string_view> &cmd, size_t pos,
+                            ScanArgs &args, Buffer &out) {
+    int64_t cursor = 0;
+    if (!str2int(cmd[pos], cursor) || cursor < 0) {
+        out_err(out, ERR_ARG, "invalid cursor");
+        return false;
+    }
+    args.cursor = (uint64_t)cursor;
+
+    for (pos++; pos < cmd.size(); pos += 2) {
+        int64_t count = 0;
+        if (pos + 1 < cmd.size() && cmd_is(cmd[pos], "match")) {
+            args.match = cmd[pos + 1];
+        } else if (pos + 1 < cmd.size() && cmd_is(cmd[pos], "count") &&
+                   str2int(cmd[pos + 1], count) && count > 0) {
+            args.count = (size_t)count;
+        } else {
+            out_err(out, ERR_ARG, "syntax error");
+            return false;
+        }
+    }
+    return true;
+}
+
+struct ScanOut {
+    Buffer *out = nullptr;
+    const ScanArgs *args = nullptr;
+    size_t examined = 0;
+    uint32_t n = 0; // array elements
+};
+
+static bool scan_filter(ScanOut *so, std::string_view name) {
+    so->examined++;
+    return so->args->match.empty() || glob_match(so->args->match, name);
+}
+
+static void cb_scan_key(KNode *node, void *arg) {
+    ScanOut *so = (ScanOut *)arg;
+    std::string_view key = knode_key(node);
+    if (scan_filter(so, key)) {
+        out_str(*so->out, key.data(), key.size());
+        so->n++;
+    }
+}
+
+static void cb_scan_member(HNode *node, void *arg) {
+    ScanOut *so = (ScanOut *)arg;
+    ZNode *znode = container_of(node, ZNode, hmap);
+    if (scan_filter(so, std::string_view(znode->name, znode->len))) {
+        out_str(*so->out, znode->name, znode->len);
+        out_double(*so->out, znode->score);
+        so->n += 2;
+    }
+}
+
+// the cursor is an `out_int()` at `cpos`
+static void scan_set_cursor(Buffer &out, size_t cpos, uint64_t cursor) {
+    int64_t val = (int64_t)cursor;
+    memcpy(&out.data[cpos + 1], &val, 8);
+}
+
+/**
+ * `[next cursor, [elements...]]`, runs cursor steps until `count` nodes
+ * were examined (before `match`), or 10 times `count` steps
+ * `step(cursor, &so)` is one cursor step of the keyspace or of a sorted set
+ * Returns the next cursor, which is also written at `*cpos` of `out`
+ */
+template <typename Step>
+static uint64_t scan_reply(const ScanArgs &args, Step &&step, Buffer &out,
+                           size_t *cpos) {
+    out_arr(out, 2);
+    *cpos = out.size;
+    out_int(out, 0);
+    size_t arr = out_begin_arr(out);
+
+    ScanOut so{&out, &args};
+    uint64_t cursor = args.cursor;
+    size_t steps = 0;
+    do {
+        cursor = step(cursor, &so);
+    } while (cursor && so.examined < args.count && ++steps < 10 * args.count);
+    out_end_arr(out, arr, so.n);
+
+    scan_set_cursor(out, *cpos, cursor);
+    return cursor;
+}
+
+/**
+ * The cursor also holds the shard, `local * threads + shard`, so a scan
+ * goes through the shards one after the other (see `CMD_CURSOR`)
+ */
+static void do_scan(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (!g_data.db.engine->scan_step) {
+        return out_err(out, ERR_ARG, "no scan with --keyspace art, use krange");
+    }
+    ScanArgs args;
+    if (!parse_scan_args(cmd, 1, args, out)) {
+        return;
+    }
+    uint64_t nshards = g_opts.threads;
+    uint64_t shard = args.cursor % nshards;
+    args.cursor /= nshards;
+
+    size_t cpos = 0;
+    uint64_t cursor = scan_reply(
+        args,
+        [](uint64_t cursor, ScanOut *so) {
+            return g_data.db.engine->scan_step(&g_data.db, cursor,
+                                               &cb_scan_key, so);
+        },
+        out, &cpos);
+    if (cursor) {
+        cursor = cursor * nshards + shard;
+    } else if (shard + 1 < nshards) {
+        cursor = shard + 1; // the start of the next shard
+    }
+    scan_set_cursor(out, cpos, cursor);
+}
+
+/**
+ * One `[shard, keys, slots, resizing, resizes, last_usec, max_usec, bytes]`
+ * array per shard, the durations are those of the keyspace resizes
+ * With `--keyspace art`, `slots` is the number of inner nodes of the tree
+ * `bytes` is the size of the index, without the entries
+ */
+static void do_dbstats(std::vector<std::string_view> &, Buffer &out) {
+    KeyspaceStats st;
+    ks_stats(&g_data.db, &st);
+    out_arr(out, 1);
+    out_arr(out, 8);
+    out_int(out, g_data.shard);
+    out_int(out, (int64_t)st.keys);
+    out_int(out, (int64_t)st.slots);
+    out_int(out, st.resizing ? 1 : 0);
+    out_int(out, (int64_t)st.resizes.count);
+    out_int(out, (int64_t)st.resizes.last_usec);
+    out_int(out, (int64_t)st.resizes.max_usec);
+    out_int(out, (int64_t)st.bytes);
+}
+
+/**
+ * One `[shard, objects, requested, used, reserved, pages, remote_frees]`
+ * array per shard, for the slab arena of its reactor (`slab_stats()`)
+ * The entries, sorted set nodes and small tables of a shard are in its
+ * arena, `used - requested` is lost to the size classes and
+ * `reserved - used` to the free slots
+ */
+static void do_slabstats(std::vector<std::string_view> &, Buffer &out) {
+    SlabStats st;
+    slab_stats(&st);
+    out_arr(out, 1);
+    out_arr(out, 7);
+    out_int(out, g_data.shard);
+    out_int(out, (int64_t)st.objects);
+    out_int(out, (int64_t)st.requested);
+    out_int(out, (int64_t)st.used);
+    out_int(out, (int64_t)st.reserved);
+    out_int(out, (int64_t)st.pages);
+    out_int(out, (int64_t)st.remote_frees);
+}
+
+/**
+ * The gauges of `MemStats` for this shard, from the structures they come
+ * from
+ */
+static void mem_publish() {
+    MemStats &mem = g_mem[g_data.shard];
+    mem.keyspace.store(ks_mem_usage(&g_data.db), std::memory_order_relaxed);
+    mem.ttl_heap.store(g_data.heap.capacity() * sizeof(HeapItem),
+                       std::memory_order_relaxed);
+    mem.buffers.store(buf_allocated(), std::memory_order_relaxed);
+}
+
+/**
+ * `memory stats`: `[name, value]` pairs, summed over the shards of
+ * `g_mem`; the gauges of the other shards are as of their last loop
+ * iteration
+ * - `total`: what the categories add up to, `overhead` the part of it that
+ *   is not `dataset`, `dataset_ratio` the part that is
+ * - `allocated`: `slab_allocated()`, what `--maxmemory` sees; it also
+ *   counts what is waiting for the readers of other reactors, and misses
+ *   the buffers and the TTL heaps, not slab allocations
+ * - `compressed_raw` over `compressed_bytes` is `compression_ratio`, for
+ *   the values kept compressed (`--compress`), part of `strings`
+ */
+static void memory_stats(Buffer &out) {
+    mem_publish();
+    uint64_t keys = 0, entries = 0, strings = 0, zsets = 0, dataset = 0;
+    uint64_t keyspace = 0, ttl_heap = 0, buffers = 0;
+    uint64_t lz_values = 0, lz_raw = 0, lz_stored = 0;
+    for (MemStats &mem : g_mem) {
+        keys += mem.keys.load(std::memory_order_relaxed);
+        entries += mem.entries.load(std::memory_order_relaxed);
+        strings += mem.strings.load(std::memory_order_relaxed);
+        zsets += mem.zsets.load(std::memory_order_relaxed);
+        dataset += mem.dataset.load(std::memory_order_relaxed);
+        keyspace += mem.keyspace.load(std::memory_order_relaxed);
+        ttl_heap += mem.ttl_heap.load(std::memory_order_relaxed);
+        buffers += mem.buffers.load(std::memory_order_relaxed);
+        lz_values += mem.lz_values.load(std::memory_order_relaxed);
+        lz_raw += mem.lz_raw.load(std::memory_order_relaxed);
+        lz_stored += mem.lz_stored.load(std::memory_order_relaxed);
+    }
+    uint64_t total = entries + strings + zsets + keyspace + ttl_heap + buffers;
+    const std::pair<const char *, uint64_t> rows[] = {
+        {"keys", keys},
+        {"entries", entries},
+        {"strings", strings},
+        {"zsets", zsets},
+        {"keyspace", keyspace},
+        {"ttl_heap", ttl_heap},
+        {"buffers", buffers},
+        {"total", total},
+        {"dataset", dataset},
+        {"overhead", total - dataset},
+        {"allocated", slab_allocated()},
+        {"compressed", lz_values},
+        {"compressed_raw", lz_raw},
+        {"compressed_bytes", lz_stored},
+    };
+    out_arr(out, (uint32_t)std::size(rows) + 2);
+    for (const auto &[name, val] : rows) {
+        out_arr(out, 2);
+        out_str(out, name, strlen(name));
+        out_int(out, (int64_t)val);
+    }
+    out_arr(out, 2);
+    out_str(out, "dataset_ratio", strlen("dataset_ratio"));
+    out_double(out, total ? (double)dataset / (double)total : 0);
+    out_arr(out, 2);
+    out_str(out, "compression_ratio", strlen("compression_ratio"));
+    out_double(out, lz_stored ? (double)lz_raw / (double)lz_stored : 0);
+}
+
+/**
+ * command: `memory usage <key>`, `memory stats`
+ * `usage`: the bytes held by the key and its value (`entry_mem()`), a
+ * sorted set with its nodes and its table; nil for a missing key
+ */
+static void do_memory(std::vector<std::string_view> &cmd, Buffer &out) {
+    if (cmd.size() == 3 && cmd_is(cmd[1], "usage")) {
+        Entry *ent = entry_lookup(cmd[2]);
+        return ent ? out_int(out, (int64_t)entry_mem(ent)) : out_nil(out);
+    }
+    if (cmd.size() == 2 && cmd_is(cmd[1], "stats")) {
+        return memory_stats(out);
+    }
+    return out_err(out, ERR_ARG, "expecting usage <key> or stats");
+}
+
+/**
+ * command: `zadd zset <score> <string>`
+ */
+static void do_zadd(std::vector<std::string_view> &cmd, Buffer &out) {
+    double score = 0;
+    if (!str2double(cmd[2], score)) {
+        return out_err(out, ERR_ARG, "expected fp number");
+    }
+
+    // lookup or create the zset
+    LookupKey lk;
+    lookup_key_init(&lk, cmd[1]);
+    Entry *ent = db_lookup(&lk);
+    if (!ent) {
+        ent = entry_new(lk.key, 0);
+        ent->type = T_ZSET;
+        ent->zset = new (slab_alloc(sizeof(ZSet))) ZSet();
+        db_insert(ent, &lk);
+    } else {
+        if (ent->type != T_ZSET) {
+            return out_err(out, ERR_TYPE, "expecting zset");
+        }
+    }
+
+    // add/update the tuple
+    std::string_view name = cmd[3];
+    mem_add(ent, -1);
+    bool added = zset_add(ent->zset, name.data(), name.size(), score);
+    mem_add(ent, 1);
+
+    return out_int(out, (int64_t)added);
+}
+
+static bool expect_zset(Buffer &out, std::string_view s, Entry **ent) {
+    *ent = entry_lookup(s);
+    if (!*ent) {
         out_nil(out);
         return false;
     }
 
-    *ent = container_of(hnode, Entry, node);
     if ((*ent)->type != T_ZSET) {
         out_err(out, ERR_TYPE, "expecting zset");
         return false;
@@ -527,7 +1559,7 @@ static bool expect_zset(std::string &out, std::string &s, Entry **ent) {
  * command: `zrem zset <name>`
  * remove <name> from zset
  */
-static void do_zrem(std::vector<std::string> &cmd, std::string &out) {
+static void do_zrem(std::vector<std::string_view> &cmd, Buffer &out) {
     Entry *ent = nullptr;
 
     // if removing a non-zset, do nothing and return
@@ -535,10 +1567,13 @@ static void do_zrem(std::vector<std::string> &cmd, std::string &out) {
         return;
     }
 
-    const std::string &name = cmd[2];
+    std::string_view name = cmd[2];
+    mem_add(ent, -1);
     ZNode *znode = zset_pop(ent->zset, name.data(), name.size());
+    mem_add(ent, 1);
     if (znode) {
-        znode_del(znode);
+        ebr_retire(znode, &znode_retire,
+                   slab_size(sizeof(ZNode) + name.size()));
     }
 
     return out_int(out, znode ? 1 : 0);
@@ -548,28 +1583,74 @@ static void do_zrem(std::vector<std::string> &cmd, std::string &out) {
  * command: `zscore zset <name>`
  * Get the score of <name>
  */
-static void do_zscore(std::vector<std::string> &cmd, std::string &out) {
+static void do_zscore(std::vector<std::string_view> &cmd, Buffer &out) {
     Entry *ent = nullptr;
     if (!expect_zset(out, cmd[1], &ent)) {
         return;
     }
 
-    const std::string &name = cmd[2];
+    std::string_view name = cmd[2];
+    if (g_data.read_db) {
+        double score = 0;
+        bool found =
+            zset_score_shared(ent->zset, name.data(), name.size(), &score);
+        return found ? out_double(out, score) : out_nil(out);
+    }
     ZNode *znode = zset_lookup(ent->zset, name.data(), name.size());
     return znode ? out_double(out, znode->score) : out_nil(out);
 }
 
+/**
+ * command: `zmscore zset <name>...`
+ * the scores in order, nil for the missing names (all of them if there is
+ * no such key)
+ */
+static void do_zmscore(std::vector<std::string_view> &cmd, Buffer &out) {
+    Entry *ent = nullptr;
+    size_t pos = out.size;
+    if (!expect_zset(out, cmd[1], &ent)) {
+        if (out.data[pos] == SER_NIL) {
+            out.size = pos;
+            out_arr(out, (uint32_t)(cmd.size() - 2));
+            for (size_t i = 2; i < cmd.size(); ++i) {
+                out_nil(out);
+            }
+        }
+        return;
+    }
+
+    out_arr(out, (uint32_t)(cmd.size() - 2));
+    if (g_data.read_db) {
+        for (size_t i = 2; i < cmd.size(); ++i) {
+            double score = 0;
+            bool found = zset_score_shared(ent->zset, cmd[i].data(),
+                                           cmd[i].size(), &score);
+            found ? out_double(out, score) : out_nil(out);
+        }
+        return;
+    }
+
+    ZNode *found[K_PREFETCH_BATCH];
+    for (size_t i = 2; i < cmd.size(); i += K_PREFETCH_BATCH) {
+        size_t n = std::min(K_PREFETCH_BATCH, cmd.size() - i);
+        zset_lookup_many(ent->zset, &cmd[i], n, found);
+        for (size_t j = 0; j < n; ++j) {
+            found[j] ? out_double(out, found[j]->score) : out_nil(out);
+        }
+    }
+}
+
 /**
  * command: `zquery zset <score> <name> <offset> <limit>`
  */
-static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
+static void do_zquery(std::vector<std::string_view> &cmd, Buffer &out) {
     // parse args
     double score = 0;
     if (!str2double(cmd[2], score)) {
         return out_err(out, ERR_ARG, "expecting fp number");
     }
 
-    const std::string &name = cmd[3];
+    std::string_view name = cmd[3];
     int64_t offset = 0;
     int64_t limit = 0;
     if (!str2int(cmd[4], offset)) {
@@ -581,9 +1662,10 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
 
     // get the zset
     Entry *ent = nullptr;
+    size_t pos = out.size;
     if (!expect_zset(out, cmd[1], &ent)) {
-        if (out[0] == SER_NIL) {
-            out.clear();
+        if (out.data[pos] == SER_NIL) {
+            out.size = pos;
             out_arr(out, 0);
         }
         return;
@@ -594,11 +1676,29 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
         return out_arr(out, 0);
     }
 
+    if (g_data.read_db) {
+        std::vector<ZHit> hits;
+        zset_query_shared(ent->zset, score, name.data(), name.size(), offset,
+                          limit, hits);
+        out_reserve(out, 1 + 4 + hits.size() * (1 + 4 + 1 + 8));
+        size_t arr = out_begin_arr(out);
+        for (const ZHit &hit : hits) {
+            out_str(out, hit.node->name, hit.node->len);
+            out_double(out, hit.score);
+        }
+        return out_end_arr(out, arr, (uint32_t)hits.size() * 2);
+    }
+
     ZNode *znode =
         zset_query(ent->zset, score, name.data(), name.size(), offset);
 
     // output
-    out_arr(out, 0);
+    uint32_t count = avl_count(ent->zset->tree);
+    if (limit < count) {
+        count = (uint32_t)limit;
+    }
+    out_reserve(out, 1 + 4 + (size_t)count * (1 + 4 + 1 + 8));
+    size_t arr = out_begin_arr(out);
     uint32_t n = 0;
     while (znode && (int64_t)n < limit) {
         out_str(out, znode->name, znode->len);
@@ -607,7 +1707,36 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
         n += 2; // why += 2?
     }
 
-    return out_update_arr(out, n);
+    return out_end_arr(out, arr, n);
+}
+
+static void do_zscan(std::vector<std::string_view> &cmd, Buffer &out) {
+    ScanArgs args;
+    if (!parse_scan_args(cmd, 2, args, out)) {
+        return;
+    }
+
+    Entry *ent = nullptr;
+    size_t pos = out.size;
+    if (!expect_zset(out, cmd[1], &ent)) {
+        if (out.data[pos] == SER_NIL) {
+            // no such key: an empty scan
+            out.size = pos;
+            out_arr(out, 2);
+            out_int(out, 0);
+            out_arr(out, 0);
+        }
+        return;
+    }
+
+    size_t cpos = 0;
+    HIndex *index = &ent->zset->hmap;
+    (void)scan_reply(
+        args,
+        [&](uint64_t cursor, ScanOut *so) {
+            return hi_scan_step(index, cursor, &cb_scan_member, so);
+        },
+        out, &cpos);
 }
 
 /* static int32_t do_request(const uint8_t *req, uint32_t reqlen,
@@ -634,100 +1763,592 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
     }
     return 0;
 } */
-static void do_request(std::vector<std::string> &cmd, std::string &out) {
-    if (cmd.size() == 1 && cmd_is(cmd[0], "keys")) {
-        do_keys(cmd, out);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "get")) {
-        do_get(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "set")) {
-        do_set(cmd, out);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "del")) {
-        do_del(cmd, out);
-    } else if (cmd.size() == 4 && cmd_is(cmd[0], "zadd")) {
-        do_zadd(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "zrem")) {
-        do_zrem(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "zscore")) {
-        do_zscore(cmd, out);
-    } else if (cmd.size() == 6 && cmd_is(cmd[0], "zquery")) {
-        do_zquery(cmd, out);
-    } else {
+/**
+ * Update TTL
+ */
+static void do_expire(std::vector<std::string_view> &cmd, Buffer &out) {
+    int64_t ttl_ms = 0;
+    if (!str2int(cmd[2], ttl_ms)) {
+        return out_err(out, ERR_ARG, "expecting int64");
+    }
+
+    Entry *ent_found = entry_lookup(cmd[1]);
+    if (ent_found) {
+        entry_set_ttl(ent_found, ttl_ms);
+    }
+
+    return out_int(out, ent_found ? 1 : 0);
+}
+
+/**
+ * Query TTL
+ */
+static void do_ttl(std::vector<std::string_view> &cmd, Buffer &out) {
+    Entry *ent_found = entry_lookup(cmd[1]);
+    if (!ent_found) {
+        return out_int(out, -2);
+    }
+
+    if (ent_found->heap_idx == K_NO_TTL) {
+        return out_int(out, -1);
+    }
+
+    uint64_t expire_at = g_data.heap[ent_found->heap_idx].val;
+    uint64_t now_us = get_monotonic_usec();
+    return out_int(out, expire_at > now_us ? (expire_at - now_us) / 1000 : 0);
+}
+
+static void do_cmdstats(std::vector<std::string_view> &cmd, Buffer &out);
+
+enum {
+    CMD_READONLY = 1 << 0,
+    CMD_WRITE = 1 << 1,
+    CMD_SLOW = 1 << 2,     /* O(N) in the size of the keyspace */
+    CMD_NOKEY = 1 << 3,    /* `cmd[1]` is not a key, runs on the local shard */
+    CMD_ALLSHARDS = 1 << 4, /* runs on every shard, the arrays are joined */
+    CMD_CURSOR = 1 << 5, /* `cmd[1]` is a scan cursor, holding the shard */
+    CMD_SHARED = 1 << 6, /* `--shared-reads`: runs here on any shard's key */
+    CMD_KEYS = 1 << 7,   /* every argument is a key, split by shard */
+    CMD_KEYVALS = 1 << 8, /* key-value pairs, split by shard */
+    CMD_DENYOOM = 1 << 9, /* may grow the dataset, see `evict_step()` */
+    CMD_SUBKEY = 1 << 10, /* `cmd[1]` is a subcommand, `cmd[2]` a key if any */
+    CMD_SORTED = 1 << 11, /* `CMD_ALLSHARDS` keys in order, then `[limit]` */
+};
+
+/**
+ * `arity` counts the command name,
+ * a negative arity means at least `-arity` arguments
+ */
+struct Command {
+    std::string_view name;
+    int32_t arity;
+    void (*handler)(std::vector<std::string_view> &cmd, Buffer &out);
+    uint32_t flags;
+};
+
+static constexpr Command g_cmds[] = {
+    {"get", 2, &do_get, CMD_READONLY | CMD_SHARED},
+    {"set", 3, &do_set, CMD_WRITE | CMD_DENYOOM},
+    {"del", 2, &do_del, CMD_WRITE},
+    {"incr", 2, &do_incr, CMD_WRITE | CMD_DENYOOM},
+    {"decr", 2, &do_decr, CMD_WRITE | CMD_DENYOOM},
+    {"incrby", 3, &do_incrby, CMD_WRITE | CMD_DENYOOM},
+    {"decrby", 3, &do_decrby, CMD_WRITE | CMD_DENYOOM},
+    {"keys", 1, &do_keys, CMD_READONLY | CMD_SLOW | CMD_NOKEY | CMD_ALLSHARDS},
+    {"zadd", 4, &do_zadd, CMD_WRITE | CMD_DENYOOM},
+    {"zrem", 3, &do_zrem, CMD_WRITE},
+    {"zscore", 3, &do_zscore, CMD_READONLY | CMD_SHARED},
+    {"zquery", 6, &do_zquery, CMD_READONLY | CMD_SHARED},
+    {"expire", 3, &do_expire, CMD_WRITE},
+    {"ttl", 2, &do_ttl, CMD_READONLY},
+    {"cmdstats", 1, &do_cmdstats, CMD_READONLY | CMD_NOKEY},
+    {"dbstats", 1, &do_dbstats, CMD_READONLY | CMD_NOKEY | CMD_ALLSHARDS},
+    {"slabstats", 1, &do_slabstats,
+     CMD_READONLY | CMD_NOKEY | CMD_ALLSHARDS},
+    {"scan", -2, &do_scan, CMD_READONLY | CMD_CURSOR},
+    {"zscan", -3, &do_zscan, CMD_READONLY},
+    {"kprefix", -2, &do_kprefix,
+     CMD_READONLY | CMD_NOKEY | CMD_ALLSHARDS | CMD_SORTED},
+    {"krange", -3, &do_krange,
+     CMD_READONLY | CMD_NOKEY | CMD_ALLSHARDS | CMD_SORTED},
+    {"mget", -2, &do_mget, CMD_READONLY | CMD_KEYS},
+    {"mset", -3, &do_mset, CMD_WRITE | CMD_KEYVALS | CMD_DENYOOM},
+    {"mdel", -2, &do_mdel, CMD_WRITE | CMD_KEYS},
+    {"zmscore", -3, &do_zmscore, CMD_READONLY | CMD_SHARED},
+    {"memory", -2, &do_memory, CMD_READONLY | CMD_SUBKEY},
+};
+
+static constexpr size_t K_NUM_CMDS = std::size(g_cmds);
+static constexpr PerfectHash<K_NUM_CMDS> g_cmd_hash = phash_build(g_cmds);
+
+/**
+ * Per-reactor counters, only written by the owning reactor,
+ * read by `cmdstats` on any reactor
+ */
+struct CmdStat {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> usec{0};
+};
+
+static std::vector<std::array<CmdStat, K_NUM_CMDS>> g_stats;
+
+static const Command *cmd_lookup(std::string_view name) {
+    int32_t idx = g_cmd_hash.find(name);
+    if (idx < 0 || !cmd_is(name, g_cmds[idx].name.data())) {
+        return nullptr;
+    }
+    return &g_cmds[idx];
+}
+
+static bool cmd_arity_ok(const Command *c, size_t argc) {
+    return c->arity >= 0 ? argc == (size_t)c->arity : argc >= (size_t)-c->arity;
+}
+
+static void do_cmdstats(std::vector<std::string_view> &, Buffer &out) {
+    size_t arr = out_begin_arr(out);
+    uint32_t n = 0;
+    for (size_t i = 0; i < K_NUM_CMDS; ++i) {
+        uint64_t calls = 0, usec = 0;
+        for (auto &stats : g_stats) {
+            calls += stats[i].calls.load(std::memory_order_relaxed);
+            usec += stats[i].usec.load(std::memory_order_relaxed);
+        }
+        if (!calls) {
+            continue;
+        }
+        out_arr(out, 3);
+        out_str(out, g_cmds[i].name.data(), g_cmds[i].name.size());
+        out_int(out, (int64_t)calls);
+        out_int(out, (int64_t)usec);
+        ++n;
+    }
+    out_end_arr(out, arr, n);
+}
+
+/**
+ * The keyspace is hash-partitioned between the reactors.
+ * The shard is taken from the high bits of a multiplicative hash so it is
+ * independent of the low bits that select the bucket within the shard.
+ */
+static uint32_t key_shard(std::string_view key) {
+    uint64_t h = str_hash((uint8_t *)key.data(), key.size());
+    return (uint32_t)(((h * 0x9E3779B97F4A7C15ull) >> 32) % g_opts.threads);
+}
+
+/**
+ * `--shared-reads`: the `db` to read `key` from when it belongs to another
+ * shard, instead of forwarding the command (`CMD_SHARED`)
+ * - every shard still has a single writer, its reactor; the readers do not
+ *   lock, they retry when a resize or a sorted set change ran under them
+ *   (see `hm_find_shared()`), and what a writer removes is only freed once
+ *   no reader can still hold it (`ebr_retire()`)
+ * - a value is never changed in place, see `entry_set_val()`
+ */
+static Keyspace *shared_db(std::string_view key) {
+    if (!g_opts.shared_reads) {
+        return nullptr;
+    }
+    uint32_t shard = key_shard(key);
+    if (shard == g_data.shard) {
+        return nullptr;
+    }
+    return g_dbs[shard].load(std::memory_order_acquire);
+}
+
+static void do_request(std::vector<std::string_view> &cmd, Buffer &out) {
+    const Command *c = cmd.empty() ? nullptr : cmd_lookup(cmd[0]);
+    if (!c) {
         // cmd not recognized
-        out_err(out, ERR_UNKNOWN, "Unknown cmd");
+        return out_err(out, ERR_UNKNOWN, "Unknown cmd");
+    }
+    if (!cmd_arity_ok(c, cmd.size())) {
+        return out_err(out, ERR_ARG, "wrong number of arguments");
+    }
+    if ((c->flags & CMD_DENYOOM) && g_data.oom) {
+        return out_err(out, ERR_OOM, "used memory > maxmemory");
+    }
+
+    uint64_t start_us = get_monotonic_usec();
+    g_data.read_db = (c->flags & CMD_SHARED) ? shared_db(cmd[1]) : nullptr;
+    if (g_data.read_db) {
+        ebr_enter();
+        c->handler(cmd, out);
+        ebr_exit();
+        g_data.read_db = nullptr;
+    } else {
+        c->handler(cmd, out);
+    }
+    CmdStat &st = g_stats[g_data.shard][c - g_cmds];
+    stat_add(st.calls, 1);
+    stat_add(st.usec, get_monotonic_usec() - start_us);
+}
+
+/**
+ * Start a response in the write buffer, the length is patched by
+ * `conn_res_end()` once the response is written after it
+ */
+static size_t conn_res_begin(Conn *conn) {
+    size_t pos = conn->wbuf.size;
+    uint32_t wlen = 0;
+    buf_append(&conn->wbuf, &wlen, 4);
+    return pos;
+}
+
+static void conn_res_end(Conn *conn, size_t pos) {
+    size_t len = conn->wbuf.size - pos - 4;
+    if (len > g_opts.max_msg) {
+        conn->wbuf.size = pos + 4;
+        out_err(conn->wbuf, ERR_2BIG, "response is too big");
+        len = conn->wbuf.size - pos - 4;
     }
+
+    uint32_t wlen = (uint32_t)len;
+    memcpy(&conn->wbuf.data[pos], &wlen, 4);
 }
 
-static bool try_one_request(Conn *conn) {
+/**
+ * Partial replies of a command executed on every shard
+ */
+struct Gather {
+    uint32_t remaining = 0; // replies not received yet
+    uint32_t n = 0;         // total number of array elements
+    Buffer data;            // concatenated array elements
+    Buffer err;             // the first error reply, if any
+    // `CMD_KEYS`/`CMD_KEYVALS`: the array elements put back in key order,
+    // or the integers summed up; a nil stays a nil
+    bool keyed = false;
+    uint8_t type = SER_NIL;
+    std::vector<std::string> elems;
+    int64_t sum = 0;
+    // `CMD_SORTED`: the keys of all the shards in order in `elems`, the
+    // first `limit` of them
+    bool sorted = false;
+    size_t limit = SIZE_MAX;
+};
+
+/**
+ * The `[limit]` after the arguments of a `CMD_SORTED` command, a bad one is
+ * the same error on every shard
+ */
+static size_t gather_limit(const Command *c,
+                           std::vector<std::string_view> &cmd) {
+    int64_t limit = 0;
+    size_t pos = (size_t)-c->arity;
+    if (cmd.size() > pos && str2int(cmd[pos], limit) && limit > 0) {
+        return (size_t)limit;
+    }
+    return SIZE_MAX;
+}
+
+static void gather_add(Gather *g, const Buffer &out) {
+    if (out.size >= 1 && out.data[0] == SER_ERR) {
+        if (!g->err.size) {
+            buf_append(&g->err, out.data, out.size);
+        }
+        return;
+    }
+    assert(out.size >= 1 + 4 && out.data[0] == SER_ARR);
+    uint32_t n = 0;
+    memcpy(&n, &out.data[1], 4);
+    if (!g->sorted) {
+        g->n += n;
+        buf_append(&g->data, &out.data[1 + 4], out.size - (1 + 4));
+        return;
+    }
+
+    // the keys of a shard are sorted already, merge them with the others
+    size_t mid = g->elems.size();
+    size_t pos = 1 + 4;
+    for (uint32_t i = 0; i < n; ++i) {
+        assert(out.data[pos] == SER_STR);
+        uint32_t len = 0;
+        memcpy(&len, &out.data[pos + 1], 4);
+        g->elems.emplace_back((const char *)&out.data[pos + 1 + 4], len);
+        pos += 1 + 4 + len;
+    }
+    assert(pos == out.size);
+    std::inplace_merge(g->elems.begin(), g->elems.begin() + (ptrdiff_t)mid,
+                       g->elems.end());
+    if (g->elems.size() > g->limit) {
+        g->elems.resize(g->limit);
+    }
+}
+
+/**
+ * The reply of a shard to its part of a multi-key command, `keys` are the
+ * positions of its keys in the whole command
+ */
+static void gather_add_keys(Gather *g, const Buffer &out,
+                            const std::vector<uint32_t> &keys) {
+    assert(out.size >= 1);
+    g->type = out.data[0];
+    if (g->type == SER_ERR) {
+        if (!g->err.size) {
+            buf_append(&g->err, out.data, out.size);
+        }
+    } else if (g->type == SER_INT) {
+        int64_t val = 0;
+        memcpy(&val, &out.data[1], 8);
+        g->sum += val;
+    } else if (g->type == SER_ARR) {
+        size_t pos = 1 + 4;
+        for (uint32_t idx : keys) {
+            size_t size = ser_size(&out.data[pos]);
+            g->elems[idx].assign((const char *)&out.data[pos], size);
+            pos += size;
+        }
+        assert(pos == out.size);
+    }
+}
+
+static void gather_reply(Gather *g, Buffer &out) {
+    if (g->err.size) {
+        // the same arguments failed the same way on every shard
+        buf_append(&out, g->err.data, g->err.size);
+    } else if (g->sorted) {
+        out_arr(out, (uint32_t)g->elems.size());
+        for (const std::string &key : g->elems) {
+            out_str(out, key);
+        }
+    } else if (!g->keyed) {
+        out_arr(out, g->n);
+        buf_append(&out, g->data.data, g->data.size);
+    } else if (g->type == SER_INT) {
+        out_int(out, g->sum);
+    } else if (g->type == SER_ARR) {
+        out_arr(out, (uint32_t)g->elems.size());
+        for (const std::string &elem : g->elems) {
+            buf_append(&out, elem.data(), elem.size());
+        }
+    } else {
+        out_nil(out);
+    }
+}
+
+/**
+ * A command forwarded to the shard owning its key,
+ * then sent back to the origin reactor with the reply in `out`
+ */
+struct Msg {
+    Conn *conn = nullptr;
+    uint32_t origin = 0; // reactor owning `conn`
+    std::vector<std::string> cmd;
+    Buffer out;
+    Gather *gather = nullptr;
+    std::vector<uint32_t> keys; // see `gather_add_keys()`
+};
+
+static void msg_send(uint32_t shard, Conn *conn,
+                     const std::vector<std::string_view> &cmd, Gather *gather,
+                     std::vector<uint32_t> keys = {}) {
+    Msg *m = new Msg();
+    m->conn = conn;
+    m->origin = g_data.shard;
+    m->cmd.assign(cmd.begin(), cmd.end()); // owned copy, `rbuf` moves on
+    m->gather = gather;
+    m->keys = std::move(keys);
+    mailbox_post(&g_mailboxes[shard], m);
+}
+
+/**
+ * `CMD_KEYS`/`CMD_KEYVALS`: every shard owning some of the keys runs the
+ * command on its own keys, this one included, the replies are merged by
+ * `gather_add_keys()`
+ */
+static bool conn_forward_keys(Conn *conn, const Command *c,
+                              std::vector<std::string_view> &cmd) {
+    size_t step = (c->flags & CMD_KEYVALS) ? 2 : 1;
+    if ((cmd.size() - 1) % step) {
+        return false; // the error is local
+    }
+
+    std::vector<std::vector<std::string_view>> parts(g_opts.threads);
+    std::vector<std::vector<uint32_t>> keys(g_opts.threads);
+    for (size_t pos = 1; pos < cmd.size(); pos += step) {
+        uint32_t shard = key_shard(cmd[pos]);
+        std::vector<std::string_view> &part = parts[shard];
+        if (part.empty()) {
+            part.push_back(cmd[0]);
+        }
+        part.insert(part.end(), cmd.begin() + pos, cmd.begin() + pos + step);
+        keys[shard].push_back((uint32_t)(pos - 1) / step);
+    }
+    if (parts[g_data.shard].size() == cmd.size()) {
+        return false; // all local
+    }
+
+    Gather *g = new Gather();
+    g->keyed = true;
+    g->elems.resize((cmd.size() - 1) / step);
+    for (uint32_t i = 0; i < g_opts.threads; ++i) {
+        if (i != g_data.shard && !parts[i].empty()) {
+            g->remaining++;
+            msg_send(i, conn, parts[i], g, std::move(keys[i]));
+        }
+    }
+    if (!parts[g_data.shard].empty()) {
+        Buffer out;
+        do_request(parts[g_data.shard], out);
+        gather_add_keys(g, out, keys[g_data.shard]);
+        out.size = 0;
+        buf_release(&out);
+    }
+
+    conn->state = STATE_WAIT;
+    conn->msg_pending = true;
+    return true;
+}
+
+/**
+ * Forward the command if it does not belong to this shard
+ * - keyed commands go to the shard of `cmd[1]`, `cmd[2]` for `CMD_SUBKEY`
+ * - `CMD_ALLSHARDS` commands run on every shard and the arrays are joined,
+ *   or merged in order for `CMD_SORTED`
+ * - `CMD_KEYS`/`CMD_KEYVALS` commands are split by shard
+ * - errors and `CMD_NOKEY` commands are handled locally, so are the
+ *   `CMD_SHARED` ones with `--shared-reads`
+ */
+static bool conn_forward(Conn *conn, std::vector<std::string_view> &cmd) {
+    const Command *c = cmd.empty() ? nullptr : cmd_lookup(cmd[0]);
+    if (!c || !cmd_arity_ok(c, cmd.size())) {
+        return false;
+    }
+
+    if (c->flags & (CMD_KEYS | CMD_KEYVALS)) {
+        return conn_forward_keys(conn, c, cmd);
+    }
+
+    if (c->flags & CMD_ALLSHARDS) {
+        Gather *g = new Gather();
+        g->remaining = g_opts.threads - 1;
+        if (c->flags & CMD_SORTED) {
+            g->sorted = true;
+            g->limit = gather_limit(c, cmd);
+        }
+        for (uint32_t i = 0; i < g_opts.threads; ++i) {
+            if (i != g_data.shard) {
+                msg_send(i, conn, cmd, g);
+            }
+        }
+        Buffer out;
+        do_request(cmd, out);
+        gather_add(g, out);
+        out.size = 0;
+        buf_release(&out);
+    } else {
+        if ((c->flags & CMD_NOKEY) ||
+            ((c->flags & CMD_SUBKEY) && cmd.size() < 3) ||
+            ((c->flags & CMD_SHARED) && shared_db(cmd[1]))) {
+            return false;
+        }
+        uint32_t shard = 0;
+        int64_t cursor = 0;
+        if (c->flags & CMD_SUBKEY) {
+            shard = key_shard(cmd[2]);
+        } else if (!(c->flags & CMD_CURSOR)) {
+            shard = key_shard(cmd[1]);
+        } else if (str2int(cmd[1], cursor) && cursor >= 0) {
+            shard = (uint32_t)((uint64_t)cursor % g_opts.threads);
+        } else {
+            return false; // the error is local
+        }
+        if (shard == g_data.shard) {
+            return false;
+        }
+        msg_send(shard, conn, cmd, nullptr);
+    }
+
+    conn->state = STATE_WAIT;
+    conn->msg_pending = true;
+    return true;
+}
+
+/**
+ * Execute one request and append its response to the write buffer
+ * The request at `off` in `rbuf`, `off` is moved past it once executed
+ * Returns false when the batch has to stop:
+ * no complete request left, no room for another response, or state change
+ */
+static bool try_one_request(Conn *conn, size_t &off) {
+    if (conn->wbuf.size >= K_WBUF_BATCH) {
+        // enough responses for one write, flush first
+        return false;
+    }
+
     // try to parse a request from buffer
-    if (conn->rbuf_size < 4) {
+    uint8_t *req = &conn->rbuf.data[off];
+    size_t avail = conn->rbuf.size - off;
+    if (avail < 4) {
         // not enough data in buffer
         // retry in the next iteration
         return false;
     }
 
     uint32_t len{};
-    memcpy(&len, &conn->rbuf[0], 4);
-    if (len > K_MAX_MSG) {
+    memcpy(&len, &req[0], 4);
+    if (len > g_opts.max_msg) {
         msg("too long");
         conn->state = STATE_END;
         return false;
     }
 
-    if (4 + len > conn->rbuf_size) {
+    if (4 + len > avail) {
         // not enough data in buffer
         return false;
     }
 
-    printf("client says: %.*s\n", len,
-           &conn->rbuf[4]); // `.*` specifies precision
+    if (g_opts.verbose) {
+        printf("client says: %.*s\n", len,
+               &req[4]); // `.*` specifies precision
+    }
 
-    // parse the request
-    std::vector<std::string> cmd;
-    if (0 != parse_req(&conn->rbuf[4], len, cmd)) {
+    // parse the request,
+    // the arguments reference `rbuf` until the batch removes it
+    std::vector<std::string_view> &cmd = g_data.cmd;
+    cmd.clear();
+    if (0 != parse_req(&req[4], len, cmd)) {
         msg("bad req");
         conn->state = STATE_END;
         return false;
     }
 
-    // received one request,
-    // generate the response
-    std::string out;
-    do_request(cmd, out);
-
-    // pack response into the buffer
-    if (4 + out.size() > K_MAX_MSG) {
-        out.clear();
-        out_err(out, ERR_2BIG, "response is too big");
+    // the key belongs to another shard, wait for its reply
+    bool forwarded = g_opts.threads > 1 && conn_forward(conn, cmd);
+    if (!forwarded) {
+        // received one request,
+        // generate the response in place
+        size_t pos = conn_res_begin(conn);
+        do_request(cmd, conn->wbuf);
+        conn_res_end(conn, pos);
     }
-    // uint32_t rescode{};
-    uint32_t wlen = (uint32_t)out.size();
-    /* // 4 + 4 because: len + status code
-    int32_t err =
-        do_request(&conn->rbuf[4], len, &rescode, &conn->wbuf[4 + 4], &wlen);
 
-    if (err) {
-        conn->state = STATE_END;
-        return false;
-    }
-    wlen += 4; */
-    memcpy(&conn->wbuf[0], &wlen, 4);
-    memcpy(&conn->wbuf[4], out.data(), out.size());
-    conn->wbuf_size = 4 + wlen; // en echo
+    // the request is done, `conn_run_batch()` removes it from the buffer
+    off += 4 + len;
 
-    // remove the request from buffer
-    size_t remaining = conn->rbuf_size - 4 - len;
-    if (remaining) {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], remaining);
-    }
-    conn->rbuf_size = remaining;
+    // continue with the next pipelined request
+    return !forwarded;
+}
 
-    // change state
-    conn->state = STATE_RES;
-    state_res(conn);
+/**
+ * Execute all the complete requests sitting in `rbuf`, then send their
+ * responses with a single write instead of one write per request
+ * The requests executed are removed from `rbuf` at the end, with one move
+ * of what is left instead of one per request
+ */
+static void conn_run_batch(Conn *conn) {
+    size_t off = 0;
+    do {
+        while (try_one_request(conn, off)) {
+        }
+        if (conn->state != STATE_REQ || conn->wbuf.size == 0) {
+            break;
+        }
 
-    // continue the outer loop (in its caller) if the request was fully
-    // processed
-    return (conn->state == STATE_REQ);
+        conn->state = STATE_RES;
+        if (g_data.ring.fd >= 0 && !conn->shm) {
+            break; // the send is submitted by the io_uring loop
+        }
+        state_res(conn);
+        // flushed without blocking, but the batch might have stopped early
+        // because `wbuf` was full
+    } while (conn->state == STATE_REQ);
+    buf_consume(&conn->rbuf, off);
+}
+
+/*
+ * Grow `rbuf` so the next read has some room, or enough room for the whole
+ * request if its header was already received
+ */
+static void conn_rbuf_prepare(Conn *conn) {
+    size_t cap = conn->rbuf.size + K_BUF_MIN;
+    if (conn->rbuf.size >= 4) {
+        uint32_t len{};
+        memcpy(&len, &conn->rbuf.data[0], 4);
+        if (len <= g_opts.max_msg && 4 + len > cap) {
+            cap = 4 + len;
+        }
+    }
+    buf_reserve(&conn->rbuf, cap);
 }
 
 /*
@@ -737,18 +2358,22 @@ static bool try_one_request(Conn *conn) {
  */
 static bool try_fill_buffer(Conn *conn) {
     // try to fill the buffer
-    assert(conn->rbuf_size < sizeof(conn->rbuf));
+    conn_rbuf_prepare(conn);
     ssize_t rv = 0;
 
     // fill `rbuf`
     do {
-        size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
-        rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
+        size_t cap = conn->rbuf.cap - conn->rbuf.size;
+        rv = conn_read(conn, &conn->rbuf.data[conn->rbuf.size], cap);
         // retrying
         // EINTR: syscall was interrupted by a signal
     } while (rv < 0 && errno == EINTR);
 
     if (rv < 0 && errno == EAGAIN) {
+        if (conn->rbuf.size == 0) {
+            // drained and idle, give the memory back to the pool
+            buf_release(&conn->rbuf);
+        }
         return false;
     }
 
@@ -759,7 +2384,7 @@ static bool try_fill_buffer(Conn *conn) {
     }
 
     if (rv == 0) {
-        if (conn->rbuf_size > 0) {
+        if (conn->rbuf.size > 0) {
             msg("unexpected EOF"); // ???
         } else {
             msg("EOF");
@@ -769,12 +2394,11 @@ static bool try_fill_buffer(Conn *conn) {
         return false;
     }
 
-    conn->rbuf_size += (size_t)rv;
-    assert(conn->rbuf_size <= sizeof(conn->rbuf));
+    conn->rbuf.size += (size_t)rv;
+    assert(conn->rbuf.size <= conn->rbuf.cap);
 
-    // try to process requests one by one
-    while (try_one_request(conn)) {
-    }
+    // process the requests, and flush their responses
+    conn_run_batch(conn);
 
     return (conn->state == STATE_REQ);
 }
@@ -794,36 +2418,188 @@ static void conn_put(std::vector<Conn *> &fd2conn, struct Conn *conn) {
     fd2conn[conn->fd] = conn;
 }
 
+/**
+ * Interest set of a connection in the epoll instance, derived from its state.
+ * Edge-triggered: the handlers must drain the socket until `EAGAIN`.
+ */
+static uint32_t conn_events(Conn *conn) {
+    if (conn->shm) {
+        // the eventfd is signaled for both new requests and free room
+        return EPOLLIN | EPOLLET;
+    }
+    switch (conn->state) {
+    case STATE_REQ:
+        return EPOLLIN | EPOLLET;
+    case STATE_RES:
+        return EPOLLOUT | EPOLLET;
+    default:
+        return conn->events; // unchanged while waiting for another shard
+    }
+}
+
+static void conn_watch(Conn *conn, int op) {
+    struct epoll_event ev {};
+    ev.events = conn_events(conn);
+    ev.data.fd = conn->fd;
+    if (op == EPOLL_CTL_MOD && ev.events == conn->events) {
+        return;
+    }
+    if (epoll_ctl(g_data.epfd, op, conn->fd, &ev)) {
+        die("epoll_ctl()");
+    }
+    conn->events = ev.events;
+}
+
+/**
+ * io_uring backend: queue the recv or send matching the state of the conn.
+ * There is at most one operation in flight per connection; the SQEs of all
+ * connections are submitted together once per loop iteration.
+ */
+static void conn_arm(Conn *conn) {
+    io_uring_sqe *sqe = uring_get_sqe(&g_data.ring);
+    if (!sqe) {
+        // SQ full, submit what we have without waiting
+        (void)uring_submit_and_wait(&g_data.ring, 0, 0);
+        sqe = uring_get_sqe(&g_data.ring);
+        assert(sqe);
+    }
+
+    if (conn->shm) {
+        // the rings are accessed directly, only wait for the peer
+        uring_prep_poll_add(sqe, conn->fd, POLLIN, (uint64_t)conn);
+    } else if (conn->state == STATE_REQ) {
+        // NOTE: unlike the epoll backend, an idle conn keeps its `rbuf`
+        // since the kernel writes into it whenever data arrives
+        conn_rbuf_prepare(conn);
+        uring_prep_recv(sqe, conn->fd, &conn->rbuf.data[conn->rbuf.size],
+                        conn->rbuf.cap - conn->rbuf.size, (uint64_t)conn);
+    } else {
+        assert(conn->state == STATE_RES);
+        uring_prep_send(sqe, conn->fd, &conn->wbuf.data[conn->wbuf_sent],
+                        conn->wbuf.size - conn->wbuf_sent, (uint64_t)conn);
+    }
+    conn->io_pending = true;
+}
+
+/**
+ * Refuse a connection over `--max-clients`:
+ * a best-effort error response, no Conn is allocated
+ */
+static void conn_reject(int conn_fd) {
+    static const char err[] = "max number of clients reached";
+    uint8_t res[4 + 1 + 4 + 4 + sizeof(err) - 1];
+    uint32_t len = sizeof(res) - 4;
+    int32_t code = ERR_MAXCLIENTS;
+    uint32_t msg_len = sizeof(err) - 1;
+    memcpy(&res[0], &len, 4);
+    res[4] = SER_ERR;
+    memcpy(&res[4 + 1], &code, 4);
+    memcpy(&res[4 + 1 + 4], &msg_len, 4);
+    memcpy(&res[4 + 1 + 4 + 4], err, msg_len);
+    (void)send(conn_fd, res, sizeof(res), MSG_DONTWAIT | MSG_NOSIGNAL);
+    (void)close(conn_fd);
+}
+
 /**
  * Initialize timers
+ * Returns 1 if a connection was accepted (or rejected),
+ * 0 if the accept queue is empty, -1 on error
  */
-static int32_t accept_new_conn(int fd) {
-    // accept
-    struct sockaddr_in client_addr {};
-    socklen_t socklen = sizeof(client_addr);
-    int conn_fd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
+static int32_t accept_new_conn(const Listener &l) {
+    int fd = l.fd;
+    // accept, the new connection fd is already in nonblocking mode
+    int conn_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (conn_fd < 0) {
-        msg("accept() error");
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            return 1; // try the next one
+        }
+        msg("accept() error"); // EMFILE, ENFILE, ENOBUFS...
         return -1;
     }
 
-    // set the new connection fd to nonblocking mode
-    fd_set_nb(conn_fd);
+    uint32_t nclients = g_nclients.fetch_add(1, std::memory_order_relaxed);
+    if (g_opts.max_clients && nclients >= g_opts.max_clients) {
+        g_nclients.fetch_sub(1, std::memory_order_relaxed);
+        conn_reject(conn_fd);
+        return 1;
+    }
+
+    // shared-memory transport: the socket only carries the handshake,
+    // the connection is then driven by the eventfd of the channel
+    ShmChan *chan = nullptr;
+    if (l.shm) {
+        chan = new ShmChan();
+        int err = shm_chan_create(chan, K_SHM_RING_SIZE);
+        if (!err) {
+            err = shm_chan_send_fds(chan, conn_fd);
+        }
+        close(conn_fd);
+        if (err) {
+            fprintf(stderr, "shm setup: %s\n", strerror(-err));
+            shm_chan_close(chan);
+            delete chan;
+            g_nclients.fetch_sub(1, std::memory_order_relaxed);
+            return 1;
+        }
+        conn_fd = chan->efd;
+    }
+
     struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
     if (!conn) {
-        close(conn_fd);
+        g_nclients.fetch_sub(1, std::memory_order_relaxed);
+        if (chan) {
+            shm_chan_close(chan);
+            delete chan;
+        } else {
+            close(conn_fd);
+        }
         return -1;
     }
 
     conn->fd = conn_fd;
     conn->state = STATE_REQ;
-    conn->rbuf_size = 0;
-    conn->wbuf_size = 0;
+    conn->rbuf = Buffer{};
+    conn->wbuf = Buffer{};
     conn->wbuf_sent = 0;
     conn->idle_start = get_monotonic_usec();
+    conn->events = 0;
+    conn->io_pending = false;
+    conn->msg_pending = false;
+    conn->shm = chan;
+    dlist_insert_before(&g_data.idle_list, &conn->idle_list);
+    conn_put(g_data.fd2conn, conn);
+    if (g_data.ring.fd >= 0) {
+        conn_arm(conn);
+    } else {
+        // registered once; only modified on STATE_REQ/STATE_RES transitions
+        conn_watch(conn, EPOLL_CTL_ADD);
+    }
+    return 1;
+}
+
+/**
+ * Drain the accept queue, at most `K_ACCEPT_BATCH` connections per loop
+ * iteration so the existing connections are not starved; the listener is
+ * level-triggered and reports the rest in the next iteration
+ */
+static void accept_new_conns(const Listener &l) {
+    for (size_t i = 0; i < K_ACCEPT_BATCH; ++i) {
+        if (accept_new_conn(l) <= 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * Move the conn to the end of the idle list
+ */
+static void conn_touch(Conn *conn) {
+    conn->idle_start = get_monotonic_usec();
+    dlist_detach(&conn->idle_list);
     dlist_insert_before(&g_data.idle_list, &conn->idle_list);
-    conn_put(g_data.fd2conn, conn);
-    return 0;
 }
 
 /**
@@ -832,16 +2608,24 @@ static int32_t accept_new_conn(int fd) {
  */
 static void connection_io(Conn *conn) {
     /**
-     * waked up by `poll`, update the idle timer by
+     * waked up by `epoll_wait`, update the idle timer by
      * moving conn to the end of the linked list
      */
-    conn->idle_start = get_monotonic_usec();
-    dlist_detach(&conn->idle_list);
-    dlist_insert_before(&g_data.idle_list, &conn->idle_list);
+    conn_touch(conn);
     if (conn->state == STATE_REQ) {
         state_req(conn);
     } else if (conn->state == STATE_RES) {
         state_res(conn);
+        // the socket might not become readable again (edge-triggered),
+        // so serve the requests that were already buffered, then drain it
+        if (conn->state == STATE_REQ) {
+            conn_run_batch(conn);
+        }
+        if (conn->state == STATE_REQ) {
+            state_req(conn);
+        }
+    } else if (conn->state == STATE_WAIT) {
+        // the socket is drained once the reply comes back
     } else {
         assert(0); // not expected
     }
@@ -849,7 +2633,7 @@ static void connection_io(Conn *conn) {
 
 /**
  * Takes the first (nearest) timer from the list and uses it to calculate the
- * timeout value of `poll()`
+ * timeout value of `epoll_wait()`
  */
 static uint32_t next_timer_ms() {
     uint64_t now_us = get_monotonic_usec();
@@ -869,6 +2653,13 @@ static uint32_t next_timer_ms() {
         next_us = g_data.heap[0].val;
     }
 
+    // keep ticking while the keyspace is resizing, see `rehash_idle()`,
+    // or while some memory waits for the readers of other reactors
+    if ((ks_resizing(&g_data.db) || ebr_pending()) &&
+        next_us > now_us + K_REHASH_TICK_MS * 1000) {
+        next_us = now_us + K_REHASH_TICK_MS * 1000;
+    }
+
     if (next_us == (uint64_t)-1) {
         return 10000; // no timer, the value does _not_ matter
     }
@@ -884,68 +2675,188 @@ static uint32_t next_timer_ms() {
 }
 
 /**
- * Update TTL
+ * Remove the conn from the list when done
  */
-static void do_expire(std::vector<std::string> &cmd, std::string &out) {
-    int64_t ttl_ms = 0;
-    if (!str2int(cmd[2], ttl_ms)) {
-        return out_err(out, ERR_ARG, "expecting int64");
+static void conn_done(Conn *conn) {
+    if (conn->io_pending || conn->msg_pending) {
+        // the kernel still owns the buffers (io_uring backend),
+        // or another shard still references the conn;
+        // finish when the operation completes or the reply comes back
+        conn->state = STATE_END;
+        if (conn->io_pending && conn->shm) {
+            uint64_t one = 1;
+            (void)!write(conn->fd, &one, sizeof(one)); // complete the poll
+        } else if (conn->io_pending) {
+            (void)shutdown(conn->fd, SHUT_RDWR);
+        } else if (g_data.ring.fd < 0) {
+            (void)epoll_ctl(g_data.epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        }
+        dlist_detach(&conn->idle_list);
+        dlist_init(&conn->idle_list); // detaching again is a no-op
+        return;
     }
 
-    Entry entry;
-    entry.key.swap(cmd[1]);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
-
-    HNode *node = hm_lookup(&g_data.db, &entry.node, &entry_eq);
-    if (node) {
-        Entry *ent_found = container_of(node, Entry, node);
-        entry_set_ttl(ent_found, ttl_ms);
+    if (g_data.ring.fd < 0) {
+        (void)epoll_ctl(g_data.epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
     }
-
-    return out_int(out, node ? 1 : 0);
+    g_data.fd2conn[conn->fd] = nullptr;
+    if (conn->shm) {
+        shm_chan_close(conn->shm); // also closes `fd`
+        delete conn->shm;
+    } else {
+        (void)close(conn->fd);
+    }
+    dlist_detach(&conn->idle_list);
+    conn->rbuf.size = 0;
+    buf_release(&conn->rbuf);
+    conn->wbuf.size = 0;
+    buf_release(&conn->wbuf);
+    free(conn);
+    g_nclients.fetch_sub(1, std::memory_order_relaxed);
 }
 
 /**
- * Query TTL
+ * io_uring backend: handle the result of the recv/send of a connection,
+ * the counterpart of `connection_io()`
  */
-static void do_ttl(std::vector<std::string> &cmd, std::string &out) {
-    Entry entry;
-    entry.key.swap(cmd[1]);
-    entry.node.hcode = str_hash((uint8_t *)entry.key.data(), entry.key.size());
+static void conn_complete(Conn *conn, int32_t res) {
+    conn->io_pending = false;
+    if (conn->state == STATE_END) {
+        return conn_done(conn); // closed while the operation was in flight
+    }
+
+    if (conn->shm) {
+        // the poll of the eventfd, the rings never block
+        connection_io(conn);
+        if (conn->state == STATE_END) {
+            conn_done(conn);
+        } else if (conn->state != STATE_WAIT) {
+            conn_arm(conn);
+        }
+        return;
+    }
 
-    HNode *node = hm_lookup(&g_data.db, &entry.node, &entry_eq);
-    if (!node) {
-        return out_int(out, -2);
+    conn_touch(conn);
+    if (res == -EINTR || res == -EAGAIN) {
+        return conn_arm(conn); // retry
     }
 
-    Entry *ent_found = container_of(node, Entry, node);
-    if (ent_found->heap_idx == (size_t)-1) {
-        return out_int(out, -1);
+    if (conn->state == STATE_REQ) {
+        if (res <= 0) {
+            msg(res == 0 ? "EOF" : "recv() error");
+            conn->state = STATE_END;
+        } else {
+            conn->rbuf.size += (size_t)res;
+            assert(conn->rbuf.size <= conn->rbuf.cap);
+            conn_run_batch(conn);
+        }
+    } else {
+        if (res < 0) {
+            msg("send() error");
+            conn->state = STATE_END;
+        } else {
+            conn->wbuf_sent += (size_t)res;
+            assert(conn->wbuf_sent <= conn->wbuf.size);
+            if (conn->wbuf_sent == conn->wbuf.size) {
+                // responses fully sent, serve the buffered requests
+                conn->state = STATE_REQ;
+                conn->wbuf_sent = 0;
+                conn->wbuf.size = 0;
+                buf_release(&conn->wbuf);
+                conn_run_batch(conn);
+            }
+        }
     }
 
-    uint64_t expire_at = g_data.heap[ent_found->heap_idx].val;
-    uint64_t now_us = get_monotonic_usec();
-    return out_int(out, expire_at > now_us ? (expire_at - now_us) / 1000 : 0);
+    if (conn->state == STATE_END) {
+        conn_done(conn);
+    } else if (conn->state != STATE_WAIT) {
+        conn_arm(conn);
+    }
 }
 
 /**
- * Remove the conn from the list when done
+ * The reply of a forwarded command came back to the origin reactor
  */
-static void conn_done(Conn *conn) {
-    g_data.fd2conn[conn->fd] = nullptr;
-    (void)close(conn->fd);
-    dlist_detach(&conn->idle_list);
-    free(conn);
+static void conn_resume(Conn *conn, const Buffer &out) {
+    conn->msg_pending = false;
+    if (conn->state == STATE_END) {
+        return conn_done(conn); // closed while waiting
+    }
+
+    size_t pos = conn_res_begin(conn);
+    buf_append(&conn->wbuf, out.data, out.size);
+    conn_res_end(conn, pos);
+    conn->state = STATE_RES;
+    if (g_data.ring.fd >= 0 && !conn->shm) {
+        return conn_arm(conn);
+    }
+
+    // flush, then continue with the buffered requests
+    connection_io(conn);
+    if (conn->state == STATE_END) {
+        conn_done(conn);
+    } else if (g_data.ring.fd < 0) {
+        conn_watch(conn, EPOLL_CTL_MOD);
+    } else if (conn->state != STATE_WAIT) {
+        conn_arm(conn);
+    }
 }
 
-static bool hnode_same(HNode *lhs, HNode *rhs) { return lhs == rhs; }
+/**
+ * Execute the commands forwarded to this shard, and resume the connections
+ * whose commands were executed by other shards
+ */
+static void process_mailbox() {
+    std::vector<void *> msgs;
+    mailbox_drain(&g_mailboxes[g_data.shard], msgs);
+    for (void *p : msgs) {
+        Msg *m = (Msg *)p;
+        if (m->origin != g_data.shard) {
+            std::vector<std::string_view> cmd(m->cmd.begin(), m->cmd.end());
+            do_request(cmd, m->out);
+            mailbox_post(&g_mailboxes[m->origin], m);
+            continue;
+        }
+
+        // a reply
+        Conn *conn = m->conn;
+        Gather *g = m->gather;
+        Buffer out;
+        if (g) {
+            if (g->keyed) {
+                gather_add_keys(g, m->out, m->keys);
+            } else {
+                gather_add(g, m->out);
+            }
+            m->out.size = 0;
+            buf_release(&m->out);
+            delete m;
+            if (--g->remaining) {
+                continue;
+            }
+            gather_reply(g, out);
+            g->data.size = 0;
+            buf_release(&g->data);
+            g->err.size = 0;
+            buf_release(&g->err);
+            delete g;
+        } else {
+            out = m->out;
+            delete m;
+        }
+        conn_resume(conn, out);
+        out.size = 0;
+        buf_release(&out);
+    }
+}
 
 /**
  * At each iteration of the event loop, list is checked in order to fire timer
  * at due time
  */
 static void process_timers() {
-    // the extra 1000us is for the ms resolution of `poll()`
+    // the extra 1000us is for the ms resolution of `epoll_wait()`
     uint64_t now_us = get_monotonic_usec() + 1000;
 
     while (!dlist_is_empty(&g_data.idle_list)) {
@@ -966,8 +2877,7 @@ static void process_timers() {
     size_t nworks = 0;
     while (!g_data.heap.empty() && g_data.heap[0].val < now_us) {
         Entry *entry = container_of(g_data.heap[0].ref, Entry, heap_idx);
-        HNode *node = hm_pop(&g_data.db, &entry->node, &hnode_same);
-        assert(node == &entry->node);
+        db_detach(entry);
         entry_del(entry);
 
         if (nworks++ >= k_max_works) {
@@ -977,116 +2887,235 @@ static void process_timers() {
     }
 }
 
-// AF_INET - IPv4
-// AF_INET6 - IPv6 or dual-stack socket
-// SOCK_STREAM - for TCP
-int main() {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+/**
+ * Higher is evicted first: the idle time, or the decayed `lfu` reversed then
+ * the idle time
+ */
+static uint64_t evict_score(Entry *ent) {
+    uint64_t idle = std::min<uint64_t>(entry_idle_ms(ent), (1ull << 48) - 1);
+    if (evict_lfu()) {
+        return (uint64_t)(255 - entry_lfu(ent)) << 48 | idle;
+    }
+    return idle;
+}
 
-    int val = 1;
-    // configure socket
-    // SO_REUSEADDR - bind to the same address if restarted
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+// keep the best `K_EVICT_POOL` candidates, each key once
+static void evict_pool_add(Entry *ent) {
+    std::vector<EvictCand> &pool = g_data.evict_pool;
+    std::string_view key = knode_key(&ent->node);
+    uint64_t score = evict_score(ent);
+    if (pool.size() == K_EVICT_POOL && score <= pool[0].score) {
+        return;
+    }
+    for (const EvictCand &cand : pool) {
+        if (cand.key == key) {
+            return;
+        }
+    }
+    if (pool.size() == K_EVICT_POOL) {
+        pool.erase(pool.begin());
+    }
+    auto pos = std::upper_bound(
+        pool.begin(), pool.end(), score,
+        [](uint64_t s, const EvictCand &cand) { return s < cand.score; });
+    pool.insert(pos, EvictCand{std::string(key), score});
+}
 
-    dlist_init(&g_data.idle_list);
-    thread_pool_init(&(g_data.tp), 4);
+/**
+ * `K_EVICT_SAMPLES` keys picked at random, from the keyspace or from the TTL
+ * heap for the volatile policies, go into a pool of the best candidates so
+ * far; the best of the pool is evicted, unless it is gone since. NULL if
+ * there is nothing to evict
+ * The pool makes up for the samples of a single round being few, or biased:
+ * `art_random()` favors the small subtrees
+ */
+static Entry *evict_pick() {
+    bool volatile_only =
+        g_opts.evict == EVICT_TTL_LRU || g_opts.evict == EVICT_TTL_LFU;
+    if (volatile_only) {
+        for (size_t i = 0; i < K_EVICT_SAMPLES && !g_data.heap.empty(); ++i) {
+            size_t pos = rand_next() % g_data.heap.size();
+            evict_pool_add(
+                container_of(g_data.heap[pos].ref, Entry, heap_idx));
+        }
+    } else {
+        KNode *nodes[K_EVICT_SAMPLES];
+        size_t n = ks_sample(&g_data.db, rand_next(), nodes, K_EVICT_SAMPLES);
+        for (size_t i = 0; i < n; ++i) {
+            evict_pool_add(entry_of(nodes[i]));
+        }
+    }
 
-    // bind
-    struct sockaddr_in addr {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
-    addr.sin_addr.s_addr = ntohl(0); // 0.0.0.0
-    int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
-    if (rv) {
-        die("bind()");
+    std::vector<EvictCand> &pool = g_data.evict_pool;
+    while (!pool.empty()) {
+        LookupKey lk;
+        lookup_key_init(&lk, pool.back().key);
+        pool.pop_back();
+        Entry *ent = entry_of(ks_lookup(&g_data.db, &lk));
+        if (ent && (!volatile_only || ent->heap_idx != K_NO_TTL)) {
+            return ent;
+        }
     }
+    return nullptr;
+}
 
-    // listen
-    rv = listen(fd, SOMAXCONN);
-    if (rv) {
-        die("listen()");
+/**
+ * `--maxmemory`: above the limit, evict up to `K_EVICT_WORK` keys of this
+ * shard, the limit being on the memory of all of them (`slab_allocated()`)
+ * What waits for the readers of other reactors is as good as freed
+ * (`ebr_retired_bytes()`); the large sorted sets freed by the thread pool
+ * still count until then, the eviction overshoots by that much
+ * With nothing left to evict, the writes that may grow the dataset are
+ * refused (`CMD_DENYOOM`) until the memory is back under the limit
+ */
+static size_t used_memory() {
+    size_t used = slab_allocated();
+    size_t retired = ebr_retired_bytes();
+    return used > retired ? used - retired : 0;
+}
+
+static void evict_step() {
+    g_data.lru_clock = lru_clock();
+    if (!g_opts.maxmemory) {
+        return;
     }
+    size_t used = used_memory();
+    size_t nworks = 0;
+    Entry *victim = nullptr;
+    while (used > g_opts.maxmemory && nworks < K_EVICT_WORK &&
+           g_opts.evict != EVICT_NONE && (victim = evict_pick())) {
+        db_detach(victim);
+        entry_del(victim);
+        nworks++;
+        used = used_memory();
+    }
+    g_data.oom = used > g_opts.maxmemory && nworks < K_EVICT_WORK;
+}
 
-    // map of all client connections , keyed by fd
-    std::vector<Conn *> fd2conn{};
-    // set the listen fd to non-blocking
-    fd_set_nb(fd);
+/**
+ * Returns the index of the listener, or `listeners.size()`
+ */
+static size_t listener_find(int fd) {
+    size_t i = 0;
+    while (i < g_data.listeners.size() && g_data.listeners[i].fd != fd) {
+        ++i;
+    }
+    return i;
+}
 
-    // the Event Loop
-    /*
-     * struct pollfd {
-     *     int fd; // socket descriptor
-     *     short events; // bitmap of events of interest
-     *     short revents; // when poll() returns, bitmap of events that occurred
-     * }
-     */
+/**
+ * Move on with an ongoing resize of the keyspace instead of leaving it to
+ * the next commands on the keyspace: whenever the loop woke up without any
+ * I/O, and at least every `K_REHASH_TICK_MS` under traffic
+ */
+static void rehash_idle(bool idle) {
+    if (!ks_resizing(&g_data.db)) {
+        return;
+    }
+    uint64_t now_us = get_monotonic_usec();
+    if (!idle && now_us < g_data.rehash_next_us) {
+        return;
+    }
+    (void)ks_rehash_for(&g_data.db, K_IDLE_REHASH_US);
+    g_data.rehash_next_us = now_us + K_REHASH_TICK_MS * 1000;
+}
+
+/**
+ * The Event Loop, readiness-based
+ */
+static void event_loop_epoll() {
     /*
-     * POLLIN
-     *  - alert when data is ready to `recv()` on this socket
+     * Unlike `poll()`, the interest list lives in the kernel: fds are
+     * registered once and `epoll_wait()` only returns the ready ones, so the
+     * cost of each iteration scales with the number of _ready_ sockets rather
+     * than the number of connected ones.
+     *
+     * EPOLLIN
      *  - there is data to read
-     * POLLOUT
-     *  - alert when data is ready to `send()` _to_ this socket _without
-     * blocking_
+     * EPOLLOUT
+     *  - data can be written _without blocking_
+     * EPOLLET
+     *  - edge-triggered, only reported when the readiness changes
+     *  - the listeners stay level-triggered since the number of connections
+     *    accepted per iteration is bounded
+     * EPOLLEXCLUSIVE
+     *  - the Unix listeners are shared by all the reactors,
+     *    only wake up one of them per connection
      */
-    std::vector<struct pollfd> poll_args{};
-    while (true) {
-        // prepare the arguments of the poll()
-        poll_args.clear();
-        // listening fd - the first pfd
-        struct pollfd pfd {
-            fd, POLLIN, 0
-        };
-        poll_args.push_back(pfd);
-        // connection fds
-        for (Conn *conn : g_data.fd2conn) {
-            if (!conn) {
-                continue;
-            }
-
-            struct pollfd pfd {};
-            pfd.fd = conn->fd;
-            pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-            pfd.events = pfd.events | POLLERR;
-            poll_args.push_back(pfd);
+    g_data.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_data.epfd < 0) {
+        die("epoll_create1()");
+    }
+    struct epoll_event lev {};
+    for (const Listener &l : g_data.listeners) {
+        bool shared = &l != &g_data.listeners[0];
+        lev.events = shared ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN;
+        lev.data.fd = l.fd;
+        if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, l.fd, &lev)) {
+            die("epoll_ctl()");
         }
+    }
+    // messages from other reactors
+    int mfd = g_mailboxes[g_data.shard].efd;
+    lev.events = EPOLLIN;
+    lev.data.fd = mfd;
+    if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, mfd, &lev)) {
+        die("epoll_ctl()");
+    }
 
-        // poll for active fds
+    std::vector<struct epoll_event> events(K_MAX_EVENTS);
+    while (true) {
+        // wait for active fds
+        // the timeout is that of the nearest timer
         int timeout_ms = (int)next_timer_ms();
-        // timeout_ms - the number of milliseconds `poll()` should _block_
-        // waiting for a file descriptor to become ready
-        // the call will block until _either_:
-        //  - a file descriptor becomes ready
-        //  - the call is interrupted by a signal handler, or
-        //  - timeout expires
-        // timeout of 0 caused `poll()` to return immediately
-        //
-        // *ready*: the requested operation will not block
-        int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeout_ms);
-        if (rv < 0) {
-            die("poll");
+        int rv = epoll_wait(g_data.epfd, events.data(), (int)events.size(),
+                            timeout_ms);
+        if (rv < 0 && errno != EINTR) {
+            die("epoll_wait");
         }
 
         // process active connections
-        for (size_t i = 1; i < poll_args.size(); ++i) {
-            if (poll_args[i].revents) {
-                Conn *conn = g_data.fd2conn[poll_args[i].fd];
-                connection_io(conn);
-
-                if (conn->state == STATE_END) {
-                    // client closed normally, or something BAD happened
-                    // destroy the connection
-                    conn_done(conn);
-                }
+        uint32_t listener_ready = 0; // bitmap of `g_data.listeners`
+        for (int i = 0; i < rv; ++i) {
+            size_t l = listener_find(events[i].data.fd);
+            if (l < g_data.listeners.size()) {
+                listener_ready |= 1u << l;
+                continue;
+            }
+            if (events[i].data.fd == mfd) {
+                process_mailbox();
+                continue;
+            }
+
+            Conn *conn = g_data.fd2conn[events[i].data.fd];
+            if (!conn || conn->state == STATE_END) {
+                continue;
+            }
+            connection_io(conn);
+
+            if (conn->state == STATE_END) {
+                // client closed normally, or something BAD happened
+                // destroy the connection
+                conn_done(conn);
+            } else {
+                conn_watch(conn, EPOLL_CTL_MOD);
             }
         }
 
         // handle timers
         // firing timers
         process_timers();
-
-        // try to accept a new connection if the listening fd is active
-        if (poll_args[0].revents) {
-            (void)accept_new_conn(fd);
+        evict_step();
+        mem_publish();
+        rehash_idle(rv == 0);
+        ebr_collect();
+        slab_collect();
+
+        // accept the new connections if a listening fd is active
+        for (size_t l = 0; l < g_data.listeners.size(); ++l) {
+            if (listener_ready & (1u << l)) {
+                accept_new_conns(g_data.listeners[l]);
+            }
         }
 
         /*
@@ -1108,5 +3137,306 @@ int main() {
         close(conn_fd);
         */
     }
+}
+
+/**
+ * The Event Loop, completion-based
+ *
+ * Instead of waiting for readiness and then calling `read()`/`write()` until
+ * `EAGAIN`, the recv/send of every active connection is queued into the
+ * io_uring SQ. A single `io_uring_enter()` per iteration submits them all and
+ * waits for completions, which are then reaped from the shared CQ without any
+ * further syscalls.
+ */
+static void event_loop_uring() {
+    // the mailbox and the listeners are watched with one-shot polls,
+    // the listener `i` uses `k_listener + i` as its user data
+    const uint64_t k_mailbox = 0;
+    const uint64_t k_listener = 1;
+    int mfd = g_mailboxes[g_data.shard].efd;
+    io_uring_sqe *sqe = uring_get_sqe(&g_data.ring);
+    uring_prep_poll_add(sqe, mfd, POLLIN, k_mailbox);
+    for (size_t l = 0; l < g_data.listeners.size(); ++l) {
+        sqe = uring_get_sqe(&g_data.ring);
+        uring_prep_poll_add(sqe, g_data.listeners[l].fd, POLLIN,
+                            k_listener + l);
+    }
+
+    while (true) {
+        // submit the queued operations and wait for at least one completion,
+        // the timeout is that of the nearest timer
+        int timeout_ms = (int)next_timer_ms();
+        int rv = uring_submit_and_wait(&g_data.ring, 1, timeout_ms);
+        if (rv < 0) {
+            errno = -rv;
+            die("io_uring_enter");
+        }
+
+        // reap completions
+        uint32_t listener_ready = 0; // bitmap of `g_data.listeners`
+        size_t ncqe = 0;
+        while (io_uring_cqe *cqe = uring_peek_cqe(&g_data.ring)) {
+            ncqe++;
+            uint64_t user_data = cqe->user_data;
+            int32_t res = cqe->res;
+            uring_cqe_seen(&g_data.ring);
+
+            if (user_data >= k_listener &&
+                user_data < k_listener + g_data.listeners.size()) {
+                listener_ready |= 1u << (user_data - k_listener);
+            } else if (user_data == k_mailbox) {
+                process_mailbox();
+                sqe = uring_get_sqe(&g_data.ring);
+                if (!sqe) {
+                    (void)uring_submit_and_wait(&g_data.ring, 0, 0);
+                    sqe = uring_get_sqe(&g_data.ring);
+                }
+                uring_prep_poll_add(sqe, mfd, POLLIN, k_mailbox);
+            } else {
+                conn_complete((Conn *)user_data, res);
+            }
+        }
+
+        // handle timers
+        process_timers();
+        evict_step();
+        mem_publish();
+        rehash_idle(ncqe == 0);
+        ebr_collect();
+        slab_collect();
+
+        // accept the new connections if a listening fd is active
+        for (size_t l = 0; l < g_data.listeners.size(); ++l) {
+            if (!(listener_ready & (1u << l))) {
+                continue;
+            }
+            accept_new_conns(g_data.listeners[l]);
+            sqe = uring_get_sqe(&g_data.ring);
+            if (!sqe) {
+                (void)uring_submit_and_wait(&g_data.ring, 0, 0);
+                sqe = uring_get_sqe(&g_data.ring);
+            }
+            uring_prep_poll_add(sqe, g_data.listeners[l].fd, POLLIN,
+                                k_listener + l);
+        }
+    }
+}
+
+// AF_INET - IPv4
+// AF_INET6 - IPv6 or dual-stack socket
+// SOCK_STREAM - for TCP
+static int listen_tcp() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    int val = 1;
+    // configure socket
+    // SO_REUSEADDR - bind to the same address if restarted
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    // SO_REUSEPORT - every reactor binds its own listener to the same port,
+    // the kernel load-balances incoming connections between them
+    if (g_opts.threads > 1) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    }
+
+    // bind
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(1234);
+    addr.sin_addr.s_addr = ntohl(0); // 0.0.0.0
+    int rv = bind(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+        die("bind()");
+    }
+
+    // listen
+    rv = listen(fd, SOMAXCONN);
+    if (rv) {
+        die("listen()");
+    }
+
+    // set the listen fd to non-blocking
+    fd_set_nb(fd);
+    return fd;
+}
+
+/**
+ * Unix socket listener, for clients on the same host
+ */
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    (void)unlink(path); // left over by a previous run
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("bind()");
+    }
+    if (listen(fd, SOMAXCONN)) {
+        die("listen()");
+    }
+    return fd;
+}
+
+// the Unix listeners, shared by all the reactors
+static std::vector<Listener> g_unix_listeners;
+
+/**
+ * Entry point of each reactor thread
+ */
+static void *reactor_main(void *arg) {
+    g_data.shard = (uint32_t)(uintptr_t)arg;
+    g_data.lru_clock = lru_clock();
+    g_data.rng = g_hash_seed ^ g_data.shard;
+    ks_init(&g_data.db, g_opts.keyspace);
+    ebr_thread(g_data.shard);
+    if (g_opts.shared_reads) {
+        g_dbs[g_data.shard].store(&g_data.db, std::memory_order_release);
+    }
+    dlist_init(&g_data.idle_list);
+    g_data.listeners.push_back(Listener{listen_tcp(), false});
+    for (const Listener &l : g_unix_listeners) {
+        g_data.listeners.push_back(l);
+    }
+
+    if (g_opts.io_uring) {
+        int err = uring_init(&g_data.ring, K_URING_ENTRIES);
+        if (err) {
+            // keep the readiness model as the fallback
+            fprintf(stderr, "io_uring unavailable (%s), using epoll\n",
+                    strerror(-err));
+        }
+    }
+
+    // the Event Loop
+    if (g_data.ring.fd >= 0) {
+        event_loop_uring();
+    } else {
+        event_loop_epoll();
+    }
+    return nullptr;
+}
+
+int main(int argc, char **argv) {
+    hash_seed_init();
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--io-uring")) {
+            g_opts.io_uring = true;
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            g_opts.threads = (uint32_t)atoi(argv[++i]);
+            if (g_opts.threads < 1) {
+                g_opts.threads = 1;
+            }
+        } else if (0 == strcmp(argv[i], "--max-msg") && i + 1 < argc) {
+            g_opts.max_msg = (size_t)strtoull(argv[++i], nullptr, 10);
+            if (g_opts.max_msg < K_BUF_MIN || g_opts.max_msg > UINT32_MAX) {
+                fprintf(stderr, "--max-msg out of range\n");
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "--max-clients") && i + 1 < argc) {
+            g_opts.max_clients = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--unix") && i + 1 < argc) {
+            g_opts.unix_path = argv[++i];
+        } else if (0 == strcmp(argv[i], "--shm") && i + 1 < argc) {
+            g_opts.shm_path = argv[++i];
+        } else if (0 == strcmp(argv[i], "--hashtable") && i + 1 < argc) {
+            const char *kind = argv[++i];
+            if (0 == strcmp(kind, "open")) {
+                hi_use_open_addressing(true);
+            } else if (0 != strcmp(kind, "chained")) {
+                fprintf(stderr, "--hashtable: chained or open\n");
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "--keyspace") && i + 1 < argc) {
+            g_opts.keyspace = ks_engine_find(argv[++i]);
+            if (!g_opts.keyspace) {
+                fprintf(stderr, "--keyspace: %s\n", ks_engine_names());
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "--shared-reads")) {
+            g_opts.shared_reads = true;
+        } else if (0 == strcmp(argv[i], "--verbose")) {
+            g_opts.verbose = true;
+        } else if (0 == strcmp(argv[i], "--compress") && i + 1 < argc) {
+            g_opts.compress = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--maxmemory") && i + 1 < argc) {
+            g_opts.maxmemory = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--maxmemory-policy") &&
+                   i + 1 < argc) {
+            const char *name = argv[++i];
+            size_t n = sizeof(k_evict_names) / sizeof(k_evict_names[0]);
+            g_opts.evict = (uint32_t)n;
+            for (size_t p = 0; p < n; ++p) {
+                if (0 == strcmp(name, k_evict_names[p])) {
+                    g_opts.evict = (uint32_t)p;
+                }
+            }
+            if (g_opts.evict == n) {
+                fprintf(stderr, "--maxmemory-policy: noeviction, "
+                                "allkeys-lru|lfu or volatile-lru|lfu\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--io-uring] [--threads N] [--max-msg BYTES] "
+                    "[--max-clients N] [--unix PATH] [--shm PATH] "
+                    "[--hashtable chained|open] [--keyspace %s] "
+                    "[--shared-reads] [--maxmemory BYTES] "
+                    "[--maxmemory-policy POLICY] [--compress BYTES] "
+                    "[--verbose]\n",
+                    argv[0], ks_engine_names());
+            return 1;
+        }
+    }
+    if (!g_opts.keyspace) {
+        g_opts.keyspace = ks_engine_find("hash");
+    }
+    if (g_opts.shared_reads &&
+        (g_open_addressing || !g_opts.keyspace->lookup_shared)) {
+        // the readers only know the chained table
+        fprintf(stderr, "--shared-reads: needs --hashtable chained and "
+                        "--keyspace hash\n");
+        return 1;
+    }
+
+    if (g_opts.unix_path) {
+        g_unix_listeners.push_back(Listener{listen_unix(g_opts.unix_path)});
+    }
+    if (g_opts.shm_path) {
+        g_unix_listeners.push_back(
+            Listener{listen_unix(g_opts.shm_path), true});
+    }
+
+    thread_pool_init(&g_tp, 4);
+    g_stats = std::vector<std::array<CmdStat, K_NUM_CMDS>>(g_opts.threads);
+    g_mem = std::vector<MemStats>(g_opts.threads);
+    g_mailboxes.resize(g_opts.threads);
+    if (g_opts.shared_reads) {
+        g_dbs = std::vector<std::atomic<Keyspace *>>(g_opts.threads);
+        ebr_init(g_opts.threads);
+    }
+    for (Mailbox &mb : g_mailboxes) {
+        mailbox_init(&mb);
+    }
+
+    // shared-nothing reactors, each one owning a shard of the keyspace;
+    // the main thread runs the first one
+    std::vector<pthread_t> threads(g_opts.threads);
+    for (uint32_t i = 1; i < g_opts.threads; ++i) {
+        int rv = pthread_create(&threads[i], nullptr, &reactor_main,
+                                (void *)(uintptr_t)i);
+        if (rv) {
+            errno = rv;
+            die("pthread_create()");
+        }
+    }
+    reactor_main((void *)(uintptr_t)0);
     return 0;
 }
@@ -0,0 +1,325 @@
+#include "shm.h"
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint32_t K_SHM_MAGIC = 0x52444D53; // "SMDR"
+
+struct ShmHeader {
+    uint32_t magic = K_SHM_MAGIC;
+    uint32_t ring_cap = 0;
+    std::atomic<uint32_t> closed{0}; // set by either side
+};
+
+/**
+ * The positions only grow, `tail - head` is the number of bytes in the ring
+ * The data follows the struct in the mapping
+ */
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head{0}; // written by the consumer
+    alignas(64) std::atomic<uint64_t> tail{0}; // written by the producer
+    alignas(64) std::atomic<uint32_t> reader_waiting{0};
+    std::atomic<uint32_t> writer_waiting{0};
+};
+
+// the mapping is shared between processes
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+const size_t K_SHM_HDR_SIZE = 64;
+static_assert(sizeof(ShmHeader) <= K_SHM_HDR_SIZE);
+
+static size_t shm_map_len(size_t ring_cap) {
+    return K_SHM_HDR_SIZE + 2 * (sizeof(ShmRing) + ring_cap);
+}
+
+static uint8_t *ring_data(ShmRing *ring) { return (uint8_t *)(ring + 1); }
+
+static ShmRing *shm_ring(void *map, size_t ring_cap, size_t idx) {
+    uint8_t *p = (uint8_t *)map + K_SHM_HDR_SIZE;
+    return (ShmRing *)(p + idx * (sizeof(ShmRing) + ring_cap));
+}
+
+static void efd_drain(int efd) {
+    uint64_t val = 0;
+    (void)!read(efd, &val, sizeof(val));
+}
+
+static void efd_signal(int efd) {
+    uint64_t one = 1;
+    (void)!write(efd, &one, sizeof(one));
+}
+
+/**
+ * The rings: 0 for the requests, 1 for the responses
+ */
+static void shm_chan_attach(ShmChan *chan, void *map, size_t map_len,
+                            size_t cap, bool server) {
+    chan->map = map;
+    chan->map_len = map_len;
+    chan->hdr = (ShmHeader *)map;
+    chan->ring_cap = cap;
+    chan->rx = shm_ring(map, cap, server ? 0 : 1);
+    chan->tx = shm_ring(map, cap, server ? 1 : 0);
+}
+
+int shm_chan_create(ShmChan *chan, size_t ring_cap) {
+    if (ring_cap == 0 || (ring_cap & (ring_cap - 1)) || ring_cap > UINT32_MAX) {
+        return -EINVAL;
+    }
+
+    size_t map_len = shm_map_len(ring_cap);
+    int memfd = memfd_create("redis-shm", MFD_CLOEXEC);
+    if (memfd < 0) {
+        return -errno;
+    }
+    if (ftruncate(memfd, (off_t)map_len)) {
+        int err = errno;
+        close(memfd);
+        return -err;
+    }
+    void *map =
+        mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(memfd);
+        return -err;
+    }
+
+    ShmHeader *hdr = new (map) ShmHeader();
+    hdr->ring_cap = (uint32_t)ring_cap;
+    new (shm_ring(map, ring_cap, 0)) ShmRing();
+    new (shm_ring(map, ring_cap, 1)) ShmRing();
+    // the server waits for the first request without having tried to read
+    shm_ring(map, ring_cap, 0)->reader_waiting.store(1);
+    shm_chan_attach(chan, map, map_len, ring_cap, true);
+    chan->memfd = memfd;
+
+    chan->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    chan->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (chan->efd < 0 || chan->peer_efd < 0) {
+        int err = errno;
+        shm_chan_close(chan);
+        return -err;
+    }
+    return 0;
+}
+
+int shm_chan_send_fds(ShmChan *chan, int sock) {
+    // the server's eventfd first, then the client's
+    int fds[3] = {chan->memfd, chan->efd, chan->peer_efd};
+    char cbuf[CMSG_SPACE(sizeof(fds))] = {};
+    char byte = 0;
+    iovec iov{&byte, 1};
+
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+    cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    ssize_t rv = 0;
+    do {
+        rv = sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+        return -errno;
+    }
+
+    // the client holds its own reference now
+    close(chan->memfd);
+    chan->memfd = -1;
+    return 0;
+}
+
+int shm_chan_recv_fds(ShmChan *chan, int sock) {
+    int fds[3] = {-1, -1, -1};
+    char cbuf[CMSG_SPACE(sizeof(fds))] = {};
+    char byte = 0;
+    iovec iov{&byte, 1};
+
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+    ssize_t rv = 0;
+    do {
+        rv = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+        return -errno;
+    }
+
+    cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    if (rv == 0 || !cm || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return -EPROTO; // e.g. an error response of `--max-clients`
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+    int err = 0;
+    struct stat st {};
+    void *map = MAP_FAILED;
+    if (fstat(fds[0], &st)) {
+        err = -errno;
+    } else {
+        map = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[0], 0);
+        if (map == MAP_FAILED) {
+            err = -errno;
+        } else if ((size_t)st.st_size < K_SHM_HDR_SIZE ||
+                   ((ShmHeader *)map)->magic != K_SHM_MAGIC ||
+                   shm_map_len(((ShmHeader *)map)->ring_cap) !=
+                       (size_t)st.st_size) {
+            err = -EPROTO;
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+    close(fds[0]);
+    if (err) {
+        close(fds[1]);
+        close(fds[2]);
+        return err;
+    }
+
+    shm_chan_attach(chan, map, (size_t)st.st_size,
+                    ((ShmHeader *)map)->ring_cap, false);
+    chan->peer_efd = fds[1];
+    chan->efd = fds[2];
+    return 0;
+}
+
+void shm_chan_close(ShmChan *chan) {
+    if (chan->hdr) {
+        chan->hdr->closed.store(1, std::memory_order_release);
+        if (chan->peer_efd >= 0) {
+            efd_signal(chan->peer_efd);
+        }
+        munmap(chan->map, chan->map_len);
+    }
+    for (int fd : {chan->efd, chan->peer_efd, chan->memfd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    *chan = ShmChan{};
+}
+
+/**
+ * Before reporting EAGAIN, the side announces that it is going to sleep,
+ * then checks the ring again. The peer publishes its progress, then checks
+ * the flag; with sequentially consistent accesses on both sides at least one
+ * of them sees the other, so a wakeup is never lost.
+ *
+ * The peer can write anything to the mapping: the capacity is the one
+ * attached, and positions further apart than that end the channel.
+ */
+ssize_t shm_chan_read(ShmChan *chan, void *buf, size_t len) {
+    ShmRing *ring = chan->rx;
+    uint64_t cap = chan->ring_cap;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    if (tail - head > cap) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (head == tail) {
+        efd_drain(chan->efd);
+        ring->reader_waiting.store(1, std::memory_order_seq_cst);
+        tail = ring->tail.load(std::memory_order_seq_cst);
+        if (head == tail) {
+            if (chan->hdr->closed.load(std::memory_order_acquire)) {
+                return 0;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        ring->reader_waiting.store(0, std::memory_order_relaxed);
+        if (tail - head > cap) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+
+    size_t n = tail - head < len ? (size_t)(tail - head) : len;
+    size_t off = (size_t)(head & (cap - 1));
+    size_t first = n < cap - off ? n : (size_t)(cap - off);
+    memcpy(buf, &ring_data(ring)[off], first);
+    memcpy((uint8_t *)buf + first, ring_data(ring), n - first);
+    ring->head.store(head + n, std::memory_order_release);
+
+    // the peer might be waiting for room
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring->writer_waiting.load(std::memory_order_relaxed) &&
+        ring->writer_waiting.exchange(0)) {
+        efd_signal(chan->peer_efd);
+    }
+    return (ssize_t)n;
+}
+
+ssize_t shm_chan_write(ShmChan *chan, const void *buf, size_t len) {
+    if (chan->hdr->closed.load(std::memory_order_acquire)) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    ShmRing *ring = chan->tx;
+    uint64_t cap = chan->ring_cap;
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (tail - head > cap) {
+        errno = EPROTO; // also `head` past `tail`
+        return -1;
+    }
+    if (tail - head == cap) {
+        efd_drain(chan->efd);
+        ring->writer_waiting.store(1, std::memory_order_seq_cst);
+        head = ring->head.load(std::memory_order_seq_cst);
+        if (tail - head == cap) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ring->writer_waiting.store(0, std::memory_order_relaxed);
+        if (tail - head > cap) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+
+    size_t room = (size_t)(cap - (tail - head));
+    size_t n = len < room ? len : room;
+    size_t off = (size_t)(tail & (cap - 1));
+    size_t first = n < cap - off ? n : (size_t)(cap - off);
+    memcpy(&ring_data(ring)[off], buf, first);
+    memcpy(ring_data(ring), (const uint8_t *)buf + first, n - first);
+    ring->tail.store(tail + n, std::memory_order_release);
+
+    // the peer might be waiting for data
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring->reader_waiting.load(std::memory_order_relaxed) &&
+        ring->reader_waiting.exchange(0)) {
+        efd_signal(chan->peer_efd);
+    }
+    return (ssize_t)n;
+}
+
+void shm_chan_wait(ShmChan *chan) {
+    pollfd pfd{chan->efd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+}
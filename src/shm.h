@@ -0,0 +1,75 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+ * Shared-memory transport between the server and a co-located client
+ * - one mapping (a memfd) holds two lock-free single-producer single-consumer
+ *   byte rings: requests (client -> server) and responses (server -> client)
+ * - the bytes are the same length-prefixed frames as on a socket
+ * - each side sleeps on its own eventfd; the peer only writes to it when the
+ *   sleeper announced itself with a flag in the ring, so a busy pipeline
+ *   does not make any syscall
+ * - the server creates the mapping and both eventfds for every connection
+ *   accepted on its `--shm` Unix socket, and passes them with SCM_RIGHTS
+ */
+struct ShmHeader;
+struct ShmRing;
+
+struct ShmChan {
+    void *map = nullptr;
+    size_t map_len = 0;
+    ShmHeader *hdr = nullptr;
+    ShmRing *rx = nullptr; // read by this side
+    ShmRing *tx = nullptr; // written by this side
+    size_t ring_cap = 0;   // as mapped, the peer can write to the header
+    int efd = -1;          // this side sleeps on it
+    int peer_efd = -1;     // wakes up the peer
+    int memfd = -1;        // server side, until it is passed to the client
+};
+
+/**
+ * Server side: allocate the rings (`ring_cap` bytes each, a power of 2)
+ * Returns 0 or -errno
+ */
+int shm_chan_create(ShmChan *chan, size_t ring_cap);
+
+/**
+ * Server side: pass the mapping and the eventfds over a Unix socket
+ * Returns 0 or -errno
+ */
+int shm_chan_send_fds(ShmChan *chan, int sock);
+
+/**
+ * Client side: receive them and map the rings
+ * Returns 0 or -errno
+ */
+int shm_chan_recv_fds(ShmChan *chan, int sock);
+
+/**
+ * Mark the channel closed, wake up the peer, then release everything
+ */
+void shm_chan_close(ShmChan *chan);
+
+/**
+ * Same contract as `read()`/`write()` on a nonblocking socket:
+ * - returns the number of bytes copied
+ * - 0 from `shm_chan_read()` once the peer closed and the ring is drained
+ * - -1 with `errno` set to EAGAIN when the ring is empty (full), in which
+ *   case `efd` becomes readable when the peer makes progress
+ * - -1 with `errno` set to EPIPE from `shm_chan_write()` if the peer closed
+ * - -1 with `errno` set to EPROTO if the peer left the positions of the ring
+ *   more than `ring_cap` bytes apart
+ */
+ssize_t shm_chan_read(ShmChan *chan, void *buf, size_t len);
+ssize_t shm_chan_write(ShmChan *chan, const void *buf, size_t len);
+
+/**
+ * Block until the peer makes progress, after an EAGAIN
+ */
+void shm_chan_wait(ShmChan *chan);
+
+#endif /* SHM_H */
@@ -0,0 +1,305 @@
+#include "slab.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
+
+// size classes of 16, 32, ... `K_SLAB_MAX` bytes
+const size_t K_SLAB_GRAIN = 16;
+const size_t K_SLAB_CLASSES = K_SLAB_MAX / K_SLAB_GRAIN;
+
+struct SlabArena;
+
+// a free slot; `size` is only set by the frees of the other threads
+struct SlabFree {
+    SlabFree *next;
+    size_t size;
+};
+
+/**
+ * The start of every page, the slots follow
+ */
+struct alignas(64) SlabPage {
+    SlabArena *owner = nullptr;
+    uint32_t cls = 0;
+    uint32_t nslots = 0;
+    uint32_t live = 0; // objects handed out
+    uint32_t bump = 0; // the slots from there on were never handed out
+    SlabFree *free = nullptr;
+    // the pages of the class with a free slot
+    SlabPage *prev = nullptr;
+    SlabPage *next = nullptr;
+};
+
+struct SlabClass {
+    SlabPage *partial = nullptr; // the pages with room, allocated from first
+    size_t pages = 0;
+    size_t objects = 0;
+};
+
+/**
+ * One per thread, created by its first allocation and never freed: another
+ * thread may still hold objects of it
+ */
+struct SlabArena {
+    SlabClass classes[K_SLAB_CLASSES];
+    size_t requested = 0;
+    size_t remote_frees = 0;
+    // pushed by the other threads, taken all at once by the owner
+    std::atomic<SlabFree *> remote{nullptr};
+    /**
+     * Bytes allocated minus freed by this thread, slabs by size class plus
+     * the larger objects; only the owner writes it, `slab_allocated()` sums
+     * all of them. The larger objects are counted by the thread freeing
+     * them, so one arena can go below 0, not the sum
+     */
+    std::atomic<int64_t> allocated{0};
+};
+
+static thread_local SlabArena *t_arena = nullptr;
+
+// every arena, for `slab_allocated()`
+static std::mutex g_arenas_mu;
+static std::vector<SlabArena *> g_arenas;
+
+static SlabArena *arena_get() {
+    if (!t_arena) {
+        t_arena = new SlabArena();
+        std::lock_guard<std::mutex> lock(g_arenas_mu);
+        g_arenas.push_back(t_arena);
+    }
+    return t_arena;
+}
+
+static void arena_count(SlabArena *arena, int64_t bytes) {
+    arena->allocated.store(
+        arena->allocated.load(std::memory_order_relaxed) + bytes,
+        std::memory_order_relaxed);
+}
+
+static size_t slab_class(size_t size) {
+    return size ? (size - 1) / K_SLAB_GRAIN : 0;
+}
+
+static size_t class_size(size_t cls) { return (cls + 1) * K_SLAB_GRAIN; }
+
+static SlabPage *page_of(void *ptr) {
+    return (SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(K_SLAB_PAGE - 1));
+}
+
+static bool page_full(SlabPage *page) {
+    return !page->free && page->bump == page->nslots;
+}
+
+static void partial_push(SlabClass *c, SlabPage *page) {
+    page->prev = nullptr;
+    page->next = c->partial;
+    if (c->partial) {
+        c->partial->prev = page;
+    }
+    c->partial = page;
+}
+
+static void partial_remove(SlabClass *c, SlabPage *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        c->partial = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->prev = page->next = nullptr;
+}
+
+/**
+ * An aligned page, cut out of a mapping twice as large
+ */
+static SlabPage *page_new(SlabArena *arena, size_t cls) {
+    void *mem = mmap(nullptr, 2 * K_SLAB_PAGE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(mem != MAP_FAILED);
+    uintptr_t start = (uintptr_t)mem;
+    uintptr_t aligned =
+        (start + K_SLAB_PAGE - 1) & ~(uintptr_t)(K_SLAB_PAGE - 1);
+    if (aligned > start) {
+        munmap(mem, aligned - start);
+    }
+    if (aligned + K_SLAB_PAGE < start + 2 * K_SLAB_PAGE) {
+        munmap((void *)(aligned + K_SLAB_PAGE),
+               start + 2 * K_SLAB_PAGE - (aligned + K_SLAB_PAGE));
+    }
+
+    SlabPage *page = new ((void *)aligned) SlabPage();
+    page->owner = arena;
+    page->cls = (uint32_t)cls;
+    page->nslots =
+        (uint32_t)((K_SLAB_PAGE - sizeof(SlabPage)) / class_size(cls));
+    arena->classes[cls].pages++;
+    return page;
+}
+
+static void page_del(SlabArena *arena, SlabPage *page) {
+    arena->classes[page->cls].pages--;
+    munmap(page, K_SLAB_PAGE);
+}
+
+/**
+ * An object of the arena of the calling thread
+ * A page left empty is unmapped, unless it is the only one of its class
+ * with room: a class going back and forth around a page boundary would
+ * map and unmap it every time
+ */
+static void local_free(SlabArena *arena, void *ptr, size_t size) {
+    SlabPage *page = page_of(ptr);
+    SlabClass *c = &arena->classes[page->cls];
+    bool was_full = page_full(page);
+    SlabFree *slot = (SlabFree *)ptr;
+    slot->next = page->free;
+    page->free = slot;
+    page->live--;
+    c->objects--;
+    arena->requested -= size;
+    arena_count(arena, -(int64_t)class_size(page->cls));
+
+    if (was_full) {
+        partial_push(c, page);
+    } else if (page->live == 0 && (c->partial != page || page->next)) {
+        partial_remove(c, page);
+        page_del(arena, page);
+    }
+}
+
+static void drain_remote(SlabArena *arena) {
+    SlabFree *slot =
+        arena->remote.exchange(nullptr, std::memory_order_acquire);
+    while (slot) {
+        SlabFree *next = slot->next;
+        local_free(arena, slot, slot->size);
+        arena->remote_frees++;
+        slot = next;
+    }
+}
+
+void *slab_alloc(size_t size) {
+    SlabArena *arena = arena_get();
+    if (size > K_SLAB_MAX) {
+        void *ptr = aligned_alloc(K_SLAB_GRAIN, slab_size(size));
+        assert(ptr);
+        arena_count(arena, (int64_t)slab_size(size));
+        return ptr;
+    }
+
+    if (arena->remote.load(std::memory_order_relaxed)) {
+        drain_remote(arena);
+    }
+
+    size_t cls = slab_class(size);
+    SlabClass *c = &arena->classes[cls];
+    SlabPage *page = c->partial;
+    if (!page) {
+        page = page_new(arena, cls);
+        partial_push(c, page);
+    }
+
+    void *ptr = nullptr;
+    if (page->free) {
+        ptr = page->free;
+        page->free = page->free->next;
+    } else {
+        ptr = (char *)(page + 1) + page->bump++ * class_size(cls);
+    }
+    page->live++;
+    c->objects++;
+    arena->requested += size;
+    arena_count(arena, (int64_t)class_size(cls));
+    if (page_full(page)) {
+        partial_remove(c, page);
+    }
+    return ptr;
+}
+
+void *slab_calloc(size_t size) {
+    if (size > K_SLAB_MAX) {
+        // the pages of a large table are only touched as it fills up,
+        // `malloc()` is 16-byte aligned on 64-bit
+        void *ptr = calloc(1, slab_size(size));
+        assert(ptr);
+        arena_count(arena_get(), (int64_t)slab_size(size));
+        return ptr;
+    }
+    void *ptr = slab_alloc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void slab_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (size > K_SLAB_MAX) {
+        free(ptr);
+        arena_count(arena_get(), -(int64_t)slab_size(size));
+        return;
+    }
+
+    // the page cannot go away while it holds `ptr`
+    SlabPage *page = page_of(ptr);
+    assert(page->cls == slab_class(size));
+    if (page->owner == t_arena) {
+        local_free(t_arena, ptr, size);
+        return;
+    }
+
+    SlabArena *owner = page->owner;
+    SlabFree *slot = (SlabFree *)ptr;
+    slot->size = size;
+    slot->next = owner->remote.load(std::memory_order_relaxed);
+    while (!owner->remote.compare_exchange_weak(slot->next, slot,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+    }
+}
+
+size_t slab_size(size_t size) {
+    return (size + K_SLAB_GRAIN - 1) & ~(K_SLAB_GRAIN - 1);
+}
+
+size_t slab_allocated() {
+    int64_t total = 0;
+    std::lock_guard<std::mutex> lock(g_arenas_mu);
+    for (SlabArena *arena : g_arenas) {
+        total += arena->allocated.load(std::memory_order_relaxed);
+    }
+    return total > 0 ? (size_t)total : 0;
+}
+
+void slab_collect() {
+    if (t_arena && t_arena->remote.load(std::memory_order_relaxed)) {
+        drain_remote(t_arena);
+    }
+}
+
+void slab_stats(SlabStats *out) {
+    *out = SlabStats{};
+    slab_collect();
+    SlabArena *arena = t_arena;
+    if (!arena) {
+        return;
+    }
+    for (size_t cls = 0; cls < K_SLAB_CLASSES; ++cls) {
+        const SlabClass &c = arena->classes[cls];
+        out->objects += c.objects;
+        out->used += c.objects * class_size(cls);
+        out->pages += c.pages;
+    }
+    out->requested = arena->requested;
+    out->reserved = out->pages * K_SLAB_PAGE;
+    out->remote_frees = arena->remote_frees;
+}
@@ -0,0 +1,62 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Size-class allocator for the small objects of the keyspace: the entries,
+ * the sorted set nodes and the small bucket arrays
+ * - sizes up to `K_SLAB_MAX` are rounded up to a multiple of 16, each class
+ *   cuts 64KB pages (`K_SLAB_PAGE`, aligned to their size) into equal slots;
+ *   no header per object, the page is found by masking the pointer
+ * - every thread allocates from its own arena, without a lock; a page that
+ *   has no object left is given back, except the last one of its class
+ * - any thread can free: an object of another arena is pushed onto a
+ *   lock-free list of its owner, who takes it back on its next allocation
+ *   (or `slab_collect()`), like the thread pool freeing a large sorted set
+ * - the caller passes the size back to `slab_free()`, larger objects go to
+ *   `malloc()` and `free()`
+ * Objects are 16-byte aligned
+ */
+const size_t K_SLAB_PAGE = 64 * 1024;
+const size_t K_SLAB_MAX = 512;
+
+void *slab_alloc(size_t size);
+
+// `slab_alloc()` zeroed
+void *slab_calloc(size_t size);
+
+// `size` as passed to `slab_alloc()`
+void slab_free(void *ptr, size_t size);
+
+// take back what the other threads freed
+void slab_collect();
+
+// what an allocation of `size` takes: its size class, or 16-byte multiples
+size_t slab_size(size_t size);
+
+/**
+ * Bytes allocated and not freed yet, over all the threads, each allocation
+ * counted as `slab_size()`; an object freed by another thread still counts
+ * until its owner took it back
+ */
+size_t slab_allocated();
+
+/**
+ * The arena of the calling thread
+ * `requested` versus `used` is the rounding to the size classes, `used`
+ * versus `reserved` the free slots of the pages
+ */
+struct SlabStats {
+    size_t objects = 0;
+    size_t requested = 0; // bytes asked for by the live objects
+    size_t used = 0;      // bytes of their size classes
+    size_t reserved = 0;  // bytes of the pages
+    size_t pages = 0;
+    size_t remote_frees = 0; // freed by other threads, ever
+};
+
+void slab_stats(SlabStats *out);
+
+#endif /* SLAB_H */
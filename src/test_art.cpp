@@ -0,0 +1,204 @@
+#include "art.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define container_of(ptr, type, member)                                        \
+    ({                                                                         \
+        const decltype(((type *)0)->member) *__mptr = (ptr);                   \
+        (type *)((char *)__mptr - offsetof(type, member));                     \
+    })
+
+/**
+ * Intrusive Data Structure
+ */
+struct Data {
+    ArtLeaf leaf;
+    std::string key;
+    uint32_t val = 0;
+};
+
+static std::string_view data_key(ArtLeaf *leaf) {
+    return container_of(leaf, Data, leaf)->key;
+}
+
+struct Container {
+    ArtTree tree;
+    std::map<std::string, uint32_t> ref;
+
+    Container() { tree.leaf_key = &data_key; }
+};
+
+static void add(Container &c, const std::string &key, uint32_t val) {
+    Data *data = new Data();
+    data->key = key;
+    data->val = val;
+    ArtLeaf *leaf = art_insert(&c.tree, &data->leaf);
+    if (leaf) {
+        assert(c.ref.count(key));
+        container_of(leaf, Data, leaf)->val = val;
+        assert(data->key == key); // left untouched
+        delete data;
+    } else {
+        assert(!c.ref.count(key));
+    }
+    c.ref[key] = val;
+}
+
+static bool del(Container &c, const std::string &key) {
+    ArtLeaf *leaf = art_pop(&c.tree, key);
+    assert(!leaf == !c.ref.count(key));
+    if (!leaf) {
+        return false;
+    }
+    delete container_of(leaf, Data, leaf);
+    c.ref.erase(key);
+    return true;
+}
+
+struct Collect {
+    std::vector<std::pair<std::string, uint32_t>> out;
+    size_t limit = (size_t)-1;
+};
+
+static bool cb_collect(ArtLeaf *leaf, const std::string &key, void *arg) {
+    Collect *col = (Collect *)arg;
+    col->out.emplace_back(key, container_of(leaf, Data, leaf)->val);
+    return col->out.size() < col->limit;
+}
+
+/**
+ * Verify the contents and the order against the reference
+ */
+static void container_verify(Container &c) {
+    assert(c.tree.size == c.ref.size());
+    // every inner node has 2 entries or more
+    assert(c.tree.nodes < c.ref.size() || c.ref.empty());
+
+    Collect col;
+    art_walk(&c.tree, "", &cb_collect, &col);
+    assert(col.out.size() == c.ref.size());
+    size_t i = 0;
+    for (const auto &[key, val] : c.ref) {
+        assert(col.out[i].first == key && col.out[i].second == val);
+        ArtLeaf *leaf = art_lookup(&c.tree, key);
+        assert(leaf && container_of(leaf, Data, leaf)->val == val);
+        ++i;
+    }
+}
+
+static void verify_from(Container &c, const std::string &start, size_t limit) {
+    Collect col;
+    col.limit = limit;
+    art_walk(&c.tree, start, &cb_collect, &col);
+    auto it = c.ref.lower_bound(start);
+    for (const auto &[key, val] : col.out) {
+        assert(it != c.ref.end() && it->first == key && it->second == val);
+        ++it;
+    }
+    assert(col.out.size() == limit || it == c.ref.end());
+}
+
+/**
+ * clean up after tests
+ */
+static void dispose(Container &c) {
+    while (!c.ref.empty()) {
+        del(c, c.ref.begin()->first);
+    }
+    assert(c.tree.root == nullptr && c.tree.nodes == 0);
+    art_destroy(&c.tree);
+}
+
+// keys sharing long prefixes, including the empty key and keys that are
+// prefixes of other keys
+static std::string rand_key(const char *alphabet, size_t maxlen) {
+    size_t n = strlen(alphabet);
+    std::string key;
+    size_t len = rand() % (maxlen + 1);
+    for (size_t i = 0; i < len; ++i) {
+        key.push_back(alphabet[rand() % n]);
+    }
+    return key;
+}
+
+static void test_basic() {
+    Container c;
+    assert(!art_lookup(&c.tree, ""));
+    add(c, "", 1);
+    add(c, "a", 2);
+    add(c, "ab", 3);
+    add(c, "abc", 4);
+    add(c, "abd", 5);
+    add(c, "b", 6);
+    add(c, "abc", 7);
+    container_verify(c);
+    assert(!art_lookup(&c.tree, "abcd"));
+    assert(!art_lookup(&c.tree, "aa"));
+
+    assert(del(c, "ab"));
+    assert(!del(c, "ab"));
+    container_verify(c);
+    assert(del(c, ""));
+    container_verify(c);
+    verify_from(c, "abc", 10);
+    verify_from(c, "abca", 10);
+    verify_from(c, "c", 10);
+    dispose(c);
+}
+
+// every node type, growing and shrinking back
+static void test_fanout() {
+    Container c;
+    for (uint32_t i = 0; i < 256; ++i) {
+        add(c, "p" + std::string(1, (char)i), i);
+        add(c, "p" + std::string(1, (char)i) + "x", i);
+        if (i % 7 == 0) {
+            container_verify(c);
+        }
+    }
+    container_verify(c);
+    verify_from(c, "p\x80", 5);
+    verify_from(c, std::string("p\xff") + "a", 5);
+    for (uint32_t i = 0; i < 256; ++i) {
+        assert(del(c, "p" + std::string(1, (char)(255 - i))));
+        if (i % 5 == 0) {
+            container_verify(c);
+        }
+    }
+    container_verify(c);
+    dispose(c);
+}
+
+static void test_random(const char *alphabet, size_t maxlen, size_t rounds) {
+    Container c;
+    for (size_t i = 0; i < rounds; ++i) {
+        std::string key = rand_key(alphabet, maxlen);
+        if (rand() % 3 == 0) {
+            del(c, key);
+        } else {
+            add(c, key, (uint32_t)i);
+        }
+        if (i % 97 == 0) {
+            container_verify(c);
+            verify_from(c, rand_key(alphabet, maxlen), 1 + rand() % 20);
+        }
+    }
+    container_verify(c);
+    dispose(c);
+}
+
+int main() {
+    srand(1);
+    test_basic();
+    test_fanout();
+    test_random("ab", 8, 20000);
+    test_random("abcdefghijklmnopqrstuvwxyz0123456789:", 12, 50000);
+    test_random("\x01\x7f\x80\xff", 6, 20000);
+    return 0;
+}
@@ -211,6 +211,41 @@ static void test_offset(uint32_t sz) {
     dispose(c);
 }
 
+/**
+ * The templated helpers, against the reference
+ */
+static void test_lower_bound(uint32_t sz) {
+    Container c;
+    std::multiset<uint32_t> ref;
+    for (uint32_t i = 0; i < sz; ++i) {
+        Data *data = new Data();
+        avl_init(&data->node);
+        data->val = (uint32_t)rand() % (2 * sz);
+        c.root = avl_insert(c.root, &data->node, [](AVLNode *l, AVLNode *r) {
+            return container_of(l, Data, node)->val <
+                   container_of(r, Data, node)->val;
+        });
+        ref.insert(data->val);
+    }
+    container_verify(c, ref);
+
+    for (uint32_t val = 0; val <= 2 * sz; ++val) {
+        AVLNode *node = avl_lower_bound(c.root, [&](AVLNode *n) {
+            return container_of(n, Data, node)->val < val;
+        });
+        auto it = ref.lower_bound(val);
+        if (it == ref.end()) {
+            assert(!node);
+        } else {
+            assert(node && container_of(node, Data, node)->val == *it);
+            // the first of the equal ones
+            assert(!avl_offset(node, -1) ||
+                   container_of(avl_offset(node, -1), Data, node)->val < *it);
+        }
+    }
+    dispose(c);
+}
+
 int main() {
     Container c;
 
@@ -262,6 +297,10 @@ int main() {
     for (uint32_t i = 1; i < 500; ++i) {
         test_offset(i);
     }
+
+    for (uint32_t i = 0; i < 300; ++i) {
+        test_lower_bound(i);
+    }
     // dispose(c);
     return 0;
 }
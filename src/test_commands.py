@@ -38,6 +38,129 @@ $ ./build/src/client zquery zset 1 "" 0 10
 (str) n2
 (dbl) 2
 (arr) end
+$ ./build/src/client zscan zset 0
+(arr) len=2
+(int) 0
+(arr) len=2
+(str) n2
+(dbl) 2
+(arr) end
+(arr) end
+$ ./build/src/client zscan zset 0 match "n[13]*" count 100
+(arr) len=2
+(int) 0
+(arr) len=0
+(arr) end
+(arr) end
+$ ./build/src/client scan 0 count
+(err) 4 syntax error
+$ ./build/src/client set tenant:1:a v
+(nil)
+$ ./build/src/client kprefix tenant:1:
+(arr) len=1
+(str) tenant:1:a
+(arr) end
+$ ./build/src/client krange tenant:1: tenant:2 10
+(arr) len=1
+(str) tenant:1:a
+(arr) end
+$ ./build/src/client kprefix tenant:2:
+(arr) len=0
+(arr) end
+$ ./build/src/client kprefix tenant: 0
+(err) 4 expecting positive int
+$ ./build/src/client mset mk1 a mk2 b mk3 c
+(nil)
+$ ./build/src/client mget mk1 nokey mk3 mk2
+(arr) len=4
+(str) a
+(nil)
+(str) c
+(str) b
+(arr) end
+$ ./build/src/client mset mk1 a mk2
+(err) 4 wrong number of arguments
+$ ./build/src/client mdel mk1 mk2 nokey
+(int) 2
+$ ./build/src/client mget mk1 mk3
+(arr) len=2
+(nil)
+(str) c
+(arr) end
+$ ./build/src/client zmscore zset n2 n1
+(arr) len=2
+(dbl) 2
+(nil)
+(arr) end
+$ ./build/src/client zmscore nokey n1 n2
+(arr) len=2
+(nil)
+(nil)
+(arr) end
+$ ./build/src/client zmscore mk3 n1
+(err) 3 expecting zset
+$ ./build/src/client set ttlkey v
+(nil)
+$ ./build/src/client ttl ttlkey
+(int) -1
+$ ./build/src/client expire ttlkey 100000
+(int) 1
+$ ./build/src/client ttl nokey
+(int) -2
+$ ./build/src/client GET ttlkey
+(str) v
+$ ./build/src/client set ttlkey xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+(nil)
+$ ./build/src/client get ttlkey
+(str) xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+$ ./build/src/client set ttlkey w
+(nil)
+$ ./build/src/client get ttlkey
+(str) w
+$ ./build/src/client zadd zk 1 n1
+(int) 1
+$ ./build/src/client get zk
+(err) 3 expecting string
+$ ./build/src/client set zk v
+(nil)
+$ ./build/src/client get zk
+(str) v
+$ ./build/src/client zscore zk n1
+(err) 3 expecting zset
+$ ./build/src/client incr counter
+(int) 1
+$ ./build/src/client incrby counter 41
+(int) 42
+$ ./build/src/client decr counter
+(int) 41
+$ ./build/src/client decrby counter 50
+(int) -9
+$ ./build/src/client get counter
+(str) -9
+$ ./build/src/client set counter 9223372036854775807
+(nil)
+$ ./build/src/client incr counter
+(err) 4 increment or decrement would overflow
+$ ./build/src/client incrby counter x
+(err) 4 expecting int
+$ ./build/src/client set counter 007
+(nil)
+$ ./build/src/client incr counter
+(err) 3 value is not an integer
+$ ./build/src/client get counter
+(str) 007
+$ ./build/src/client memory usage counter
+(int) 64
+$ ./build/src/client memory usage nokey
+(nil)
+$ ./build/src/client memory nosub
+(err) 4 expecting usage <key> or stats
+$ ./build/src/client incr zk
+(err) 3 value is not an integer
+$ ./build/src/client get
+(err) 4 wrong number of arguments
+$ ./build/src/client nocmd x
+(err) 1 Unknown cmd
 """
 
 import shlex
@@ -61,3 +184,40 @@ assert len(cmds) == len(outputs)
 for cmd, expected in zip(cmds, outputs):
     out = subprocess.check_output(shlex.split(cmd)).decode("utf-8")
     assert out == expected, f"cmd:{cmd} out:{out}"
+
+
+# a scan of every shard, following the cursor from 0
+def scan_keys(*args):
+    cursor, keys = "0", []
+    while True:
+        cmd = ["./build/src/client", "scan", cursor, *args]
+        out = subprocess.check_output(cmd).decode("utf-8").splitlines()
+        cursor = out[1].removeprefix("(int) ")
+        keys += [x.removeprefix("(str) ") for x in out if x.startswith("(str) ")]
+        if cursor == "0":
+            return keys
+
+
+# keys are stored with their value right after them
+subprocess.check_output(["./build/src/client", "set", "abc", "hello"])
+keys = scan_keys()
+assert "abc" in keys and "abchello" not in keys, keys
+assert scan_keys("match", "abc") == ["abc"], scan_keys("match", "abc")
+subprocess.check_output(["./build/src/client", "del", "abc"])
+
+
+# with --threads, the keys of every shard merged in order, then cut to limit
+def client(*args):
+    cmd = ["./build/src/client", *args]
+    out = subprocess.check_output(cmd).decode("utf-8").splitlines()
+    return [x.removeprefix("(str) ") for x in out if x.startswith("(str) ")]
+
+
+keys = [f"t:{i}" for i in range(10, 30)]
+for key in keys:
+    client("set", key, "v")
+assert client("kprefix", "t:", "3") == keys[:3], client("kprefix", "t:", "3")
+assert client("krange", "t:1", "t:2") == keys[:10], client("krange", "t:1", "t:2")
+assert client("krange", "t:15", "", "4") == keys[5:9]
+for key in keys:
+    client("del", key)
@@ -0,0 +1,120 @@
+#include "lz.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> compress(const std::string &data) {
+    std::vector<uint8_t> out(lz_bound(data.size()));
+    size_t n = lz_compress((const uint8_t *)data.data(), data.size(),
+                           out.data(), out.size());
+    assert(n > 0);
+    out.resize(n);
+    return out;
+}
+
+static void round_trip(const std::string &data) {
+    std::vector<uint8_t> comp = compress(data);
+    std::string back(data.size(), '\0');
+    assert(lz_decompress(comp.data(), comp.size(), (uint8_t *)back.data(),
+                         back.size()));
+    assert(back == data);
+
+    // a size off by one is not the block
+    std::string other(data.size() + 1, '\0');
+    assert(!lz_decompress(comp.data(), comp.size(), (uint8_t *)other.data(),
+                          other.size()));
+
+    // too small an output buffer fails, unless it is still large enough
+    if (comp.size() > 1) {
+        std::vector<uint8_t> small(comp.size() - 1);
+        size_t n = lz_compress((const uint8_t *)data.data(), data.size(),
+                               small.data(), small.size());
+        assert(n == 0);
+    }
+}
+
+static std::string rand_text(size_t len, const char *alphabet) {
+    size_t n = strlen(alphabet);
+    std::string s;
+    while (s.size() < len) {
+        s.push_back(alphabet[rand() % n]);
+    }
+    return s;
+}
+
+static std::string json_like(size_t len) {
+    std::string s = "[";
+    for (size_t i = 0; s.size() < len; ++i) {
+        s += "{\"id\":" + std::to_string(rand() % 100000) +
+             ",\"name\":\"user" + std::to_string(i) +
+             "\",\"active\":" + (rand() % 2 ? "true" : "false") +
+             ",\"tags\":[\"" + rand_text(1 + rand() % 8, "abcdef") + "\"]},";
+    }
+    s.resize(len);
+    return s;
+}
+
+static void test_basic() {
+    round_trip("");
+    round_trip("a");
+    round_trip("abcdefghijkl");
+    round_trip("abcdefghijklm");
+    round_trip(std::string(13, 'a'));
+    round_trip(std::string(1000, 'a'));
+    round_trip(std::string(100000, 'x'));
+    round_trip("abcabcabcabcabcabcabcabcabcabcabcabc");
+    for (size_t len = 0; len < 300; ++len) {
+        round_trip(rand_text(len, "ab"));
+        round_trip(rand_text(len, "abcdefghijklmnopqrstuvwxyz"));
+    }
+}
+
+static void test_ratio() {
+    std::string data = json_like(50000);
+    std::vector<uint8_t> comp = compress(data);
+    assert(comp.size() * 2 < data.size());
+    round_trip(data);
+
+    // random bytes do not compress, the bound holds
+    std::string noise;
+    for (size_t i = 0; i < 70000; ++i) {
+        noise.push_back((char)(rand() & 0xff));
+    }
+    round_trip(noise);
+    assert(compress(noise).size() <= lz_bound(noise.size()));
+
+    // matches further back than 64KB are not used
+    std::string far = rand_text(30000, "0123456789") + noise +
+                      data.substr(0, 30000);
+    round_trip(far + far.substr(0, 1000));
+}
+
+// damaged blocks are rejected or decode to something, never out of bounds
+static void test_corrupt() {
+    std::string data = json_like(5000);
+    std::vector<uint8_t> comp = compress(data);
+    std::string back(data.size(), '\0');
+    for (size_t i = 0; i < 20000; ++i) {
+        std::vector<uint8_t> bad = comp;
+        size_t flips = 1 + rand() % 4;
+        for (size_t f = 0; f < flips; ++f) {
+            bad[rand() % bad.size()] ^= (uint8_t)(1 + rand() % 255);
+        }
+        bad.resize(bad.size() - (rand() % 3 == 0 ? rand() % bad.size() : 0));
+        lz_decompress(bad.data(), bad.size(), (uint8_t *)back.data(),
+                      back.size());
+    }
+}
+
+int main() {
+    srand(1);
+    test_basic();
+    test_ratio();
+    test_corrupt();
+    return 0;
+}
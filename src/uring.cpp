@@ -0,0 +1,196 @@
+#include "uring.h"
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, const void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, arg, argsz);
+}
+
+int uring_init(URing *ring, unsigned entries) {
+    io_uring_params p{};
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    // the timeout of `uring_submit_and_wait()` needs IORING_ENTER_EXT_ARG
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return -ENOSYS;
+    }
+
+    ring->fd = fd;
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        // both rings share one mapping
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        *ring = URing{};
+        return -err;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(nullptr, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            int err = errno;
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(fd);
+            *ring = URing{};
+            return -err;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        int err = errno;
+        uring_destroy(ring);
+        return -err;
+    }
+    ring->sqes = (io_uring_sqe *)sqes;
+
+    char *sq = (char *)ring->sq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    ring->sqe_tail = *ring->sq_tail;
+
+    // the SQ is an array of indexes into `sqes`;
+    // use the identity mapping so the slot of an SQE is `tail & mask`
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    char *cq = (char *)ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_destroy(URing *ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    *ring = URing{};
+}
+
+io_uring_sqe *uring_get_sqe(URing *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return nullptr; // full
+    }
+
+    io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void prep_rw(io_uring_sqe *sqe, uint8_t op, int fd, const void *buf,
+                    size_t len, uint64_t user_data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv(io_uring_sqe *sqe, int fd, void *buf, size_t len,
+                     uint64_t user_data) {
+    prep_rw(sqe, IORING_OP_RECV, fd, buf, len, user_data);
+}
+
+void uring_prep_send(io_uring_sqe *sqe, int fd, const void *buf, size_t len,
+                     uint64_t user_data) {
+    prep_rw(sqe, IORING_OP_SEND, fd, buf, len, user_data);
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_prep_poll_add(io_uring_sqe *sqe, int fd, uint32_t events,
+                         uint64_t user_data) {
+    prep_rw(sqe, IORING_OP_POLL_ADD, fd, nullptr, 0, user_data);
+    sqe->poll32_events = events;
+}
+
+int uring_submit_and_wait(URing *ring, unsigned wait_nr, int timeout_ms) {
+    // publish the queued SQEs to the kernel
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit =
+        ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    __kernel_timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (wait_nr) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    int rv = 0;
+    do {
+        rv = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags, &arg,
+                                sizeof(arg));
+    } while (rv < 0 && errno == EINTR && !wait_nr);
+
+    if (rv < 0 && (errno == ETIME || errno == EINTR)) {
+        return 0; // timed out, the caller just looks at the CQ
+    }
+    return rv < 0 ? -errno : rv;
+}
+
+io_uring_cqe *uring_peek_cqe(URing *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(URing *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
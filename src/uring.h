@@ -0,0 +1,71 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+/**
+ * A minimal io_uring wrapper on top of the raw syscalls (no liburing)
+ * - the submission queue (SQ) is filled by the application
+ * - the completion queue (CQ) is filled by the kernel
+ * - both are rings shared with the kernel through `mmap()`
+ */
+struct URing {
+    int fd = -1;
+
+    // submission queue
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    io_uring_sqe *sqes = nullptr;
+    unsigned sqe_tail = 0; // local tail, published on submit
+
+    // completion queue
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    // mappings
+    void *sq_ptr = nullptr;
+    size_t sq_len = 0;
+    void *cq_ptr = nullptr;
+    size_t cq_len = 0;
+    size_t sqes_len = 0;
+};
+
+/**
+ * Returns 0 on success, or -errno if io_uring is unavailable
+ * (old kernel, disabled by seccomp/sysctl, missing features)
+ */
+int uring_init(URing *ring, unsigned entries);
+void uring_destroy(URing *ring);
+
+/**
+ * Returns a zeroed SQE, or NULL if the submission queue is full
+ */
+io_uring_sqe *uring_get_sqe(URing *ring);
+
+void uring_prep_recv(io_uring_sqe *sqe, int fd, void *buf, size_t len,
+                     uint64_t user_data);
+void uring_prep_send(io_uring_sqe *sqe, int fd, const void *buf, size_t len,
+                     uint64_t user_data);
+void uring_prep_poll_add(io_uring_sqe *sqe, int fd, uint32_t events,
+                         uint64_t user_data);
+
+/**
+ * Submit all queued SQEs and wait for at least `wait_nr` completions,
+ * or until `timeout_ms` expires, in a single `io_uring_enter()`
+ */
+int uring_submit_and_wait(URing *ring, unsigned wait_nr, int timeout_ms);
+
+/**
+ * Returns the next completion, or NULL if the CQ is empty
+ * `uring_cqe_seen()` must be called once it is consumed
+ */
+io_uring_cqe *uring_peek_cqe(URing *ring);
+void uring_cqe_seen(URing *ring);
+
+#endif /* URING_H */
@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "buffer.h"
 #include "constants.h"
 #include <cassert>
 #include <cerrno>
@@ -11,8 +12,10 @@
 #include <cstring>
 #include <fcntl.h>
 #include <string>
+#include <string_view>
 #include <strings.h>
 #include <unistd.h>
+#include <utility>
 
 static void msg(const char *message) { fprintf(stderr, "%s\n", message); }
 
@@ -72,62 +75,190 @@ static void fd_set_nb(int fd) {
 }
 
 /*
- * compares two null-terminated strings, ignoring cases
+ * compares the argument with a null-terminated string, ignoring cases
  */
-static bool cmd_is(const std::string &word, const char *cmd) {
-    return 0 == strcasecmp(word.c_str(), cmd);
+static bool cmd_is(std::string_view word, const char *cmd) {
+    size_t len = strlen(cmd);
+    return word.size() == len && 0 == strncasecmp(word.data(), cmd, len);
 }
 
-/*
- * Fowler–Noll–Vo
+/**
+ * A `[...]` class of `glob_match()`, `p` is the position of the `[`
+ * Sets `next` to the position after the closing `]`
  */
-static uint64_t str_hash(const uint8_t *data, size_t len) {
-    uint32_t hash = 0x811C9DC5;
-    for (size_t i = 0; i < len; ++i) {
-        hash = (hash + data[i]) * 0x811C9DC5;
+static bool glob_class(std::string_view pat, size_t p, uint8_t c,
+                       size_t *next) {
+    size_t i = p + 1;
+    bool neg = i < pat.size() && pat[i] == '^';
+    i += neg ? 1 : 0;
+
+    bool hit = false;
+    while (i < pat.size() && pat[i] != ']') {
+        if (pat[i] == '\\' && i + 1 < pat.size()) {
+            ++i;
+        }
+        uint8_t lo = (uint8_t)pat[i];
+        if (i + 2 < pat.size() && pat[i + 1] == '-' && pat[i + 2] != ']') {
+            uint8_t hi = (uint8_t)pat[i + 2];
+            if (lo > hi) {
+                std::swap(lo, hi);
+            }
+            hit = hit || (lo <= c && c <= hi);
+            i += 3;
+        } else {
+            hit = hit || lo == c;
+            i += 1;
+        }
     }
-    return hash;
+    *next = i < pat.size() ? i + 1 : i; // an unterminated class ends there
+    return hit != neg;
 }
 
-static void out_nil(std::string &out) { out.push_back(SER_NIL); }
+/**
+ * Glob-style matching of the whole string: `*`, `?`, `[abc]`, `[a-z]`,
+ * `[^...]` and `\` to escape
+ * Backtracks to the last `*` only, so the time is O(pattern * string)
+ */
+static bool glob_match(std::string_view pat, std::string_view str) {
+    size_t p = 0, s = 0;
+    size_t star_p = std::string_view::npos, star_s = 0;
+    while (s < str.size()) {
+        if (p < pat.size() && pat[p] == '*') {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+        if (p < pat.size()) {
+            size_t next = p + 1;
+            bool ok = false;
+            if (pat[p] == '?') {
+                ok = true;
+            } else if (pat[p] == '[') {
+                ok = glob_class(pat, p, (uint8_t)str[s], &next);
+            } else {
+                if (pat[p] == '\\' && p + 1 < pat.size()) {
+                    next = ++p + 1;
+                }
+                ok = pat[p] == str[s];
+            }
+            if (ok) {
+                p = next;
+                ++s;
+                continue;
+            }
+        }
+        if (star_p == std::string_view::npos) {
+            return false;
+        }
+        // let the last `*` take one more byte
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p < pat.size() && pat[p] == '*') {
+        ++p;
+    }
+    return p == pat.size();
+}
 
-static void out_str(std::string &out, const char *s, size_t size) {
-    out.push_back(SER_STR);
+/**
+ * Response writer
+ * The values are encoded straight into the output buffer, which is the
+ * connection's `wbuf` when the command runs on the reactor owning it
+ */
+static void out_reserve(Buffer &out, size_t bytes) {
+    buf_reserve(&out, out.size + bytes);
+}
+
+static void out_nil(Buffer &out) {
+    uint8_t tag = SER_NIL;
+    buf_append(&out, &tag, 1);
+}
+
+static void out_str(Buffer &out, const char *s, size_t size) {
     uint32_t len = (uint32_t)size;
-    out.append((char *)&len, 4);
-    out.append(s, len);
+    out_reserve(out, 1 + 4 + len);
+    out.data[out.size] = SER_STR;
+    memcpy(&out.data[out.size + 1], &len, 4);
+    memcpy(&out.data[out.size + 1 + 4], s, len);
+    out.size += 1 + 4 + len;
 }
 
-static void out_str(std::string &out, const std::string &val) {
+static void out_str(Buffer &out, const std::string &val) {
     return out_str(out, val.data(), val.size());
 }
 
-static void out_int(std::string &out, int64_t val) {
-    out.push_back(SER_INT);
-    out.append((char *)&val, 8);
+static void out_int(Buffer &out, int64_t val) {
+    out_reserve(out, 1 + 8);
+    out.data[out.size] = SER_INT;
+    memcpy(&out.data[out.size + 1], &val, 8);
+    out.size += 1 + 8;
 }
 
-static void out_err(std::string &out, int32_t code, const std::string &msg) {
-    out.push_back(SER_ERR);
-    out.append((char *)&code, 4);
+static void out_err(Buffer &out, int32_t code, const std::string &msg) {
     uint32_t len = (uint32_t)msg.size();
-    out.append((char *)&len, 4);
-    out.append(msg);
+    out_reserve(out, 1 + 4 + 4 + len);
+    out.data[out.size] = SER_ERR;
+    memcpy(&out.data[out.size + 1], &code, 4);
+    memcpy(&out.data[out.size + 1 + 4], &len, 4);
+    memcpy(&out.data[out.size + 1 + 4 + 4], msg.data(), len);
+    out.size += 1 + 4 + 4 + len;
+}
+
+static void out_arr(Buffer &out, uint32_t n) {
+    out_reserve(out, 1 + 4);
+    out.data[out.size] = SER_ARR;
+    memcpy(&out.data[out.size + 1], &n, 4);
+    out.size += 1 + 4;
+}
+
+/**
+ * Array of unknown length, returns the position to patch with `out_end_arr()`
+ */
+static size_t out_begin_arr(Buffer &out) {
+    size_t pos = out.size;
+    out_arr(out, 0);
+    return pos;
 }
 
-static void out_arr(std::string &out, uint32_t n) {
-    out.push_back(SER_ARR);
-    out.append((char *)&n, 4);
+static void out_end_arr(Buffer &out, size_t pos, uint32_t n) {
+    assert(out.data[pos] == SER_ARR);
+    memcpy(&out.data[pos + 1], &n, 4);
 }
 
-static void out_update_arr(std::string &out, uint32_t n) {
-    assert(out[0] == SER_ARR);
-    memcpy(&out[1], &n, 4);
+static void out_double(Buffer &out, double val) {
+    out_reserve(out, 1 + 8);
+    out.data[out.size] = SER_DBL;
+    memcpy(&out.data[out.size + 1], &val, 8);
+    out.size += 1 + 8;
 }
 
-static void out_double(std::string &out, double val) {
-    out.push_back(SER_DBL);
-    out.append((char *)&val, 8);
+/**
+ * Size of the serialized value at `data`, a complete one written by the
+ * functions above
+ */
+static size_t ser_size(const uint8_t *data) {
+    uint32_t len = 0;
+    switch (data[0]) {
+    case SER_ERR:
+        memcpy(&len, &data[1 + 4], 4);
+        return 1 + 4 + 4 + len;
+    case SER_STR:
+        memcpy(&len, &data[1], 4);
+        return 1 + 4 + len;
+    case SER_INT:
+    case SER_DBL:
+        return 1 + 8;
+    case SER_ARR: {
+        memcpy(&len, &data[1], 4);
+        size_t size = 1 + 4;
+        for (uint32_t i = 0; i < len; ++i) {
+            size += ser_size(&data[size]);
+        }
+        return size;
+    }
+    default:
+        return 1; // SER_NIL
+    }
 }
 
 #endif /* UTILS_H */
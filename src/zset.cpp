@@ -1,7 +1,12 @@
 #include "zset.h"
 #include "avl.h"
+#include "constants.h"
+#include "hash.h"
 #include "hashtable.h"
+#include "omap.h"
+#include "slab.h"
 #include "utils.h"
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -9,11 +14,13 @@
 #include <cstdlib>
 #include <cstring>
 
+// deeper than any AVL tree, a longer descent saw a tree being changed
+const size_t K_ZSET_MAX_HOPS = 256;
+
 static uint32_t min(size_t lhs, size_t rhs) { return lhs < rhs ? lhs : rhs; }
 
 ZNode *znode_new(const char *name, size_t len, double score) {
-    ZNode *node = (ZNode *)malloc(sizeof(ZNode) + len);
-    assert(node);
+    ZNode *node = (ZNode *)slab_alloc(sizeof(ZNode) + len);
 
     avl_init(&node->tree);
     node->hmap.next = nullptr;
@@ -25,24 +32,10 @@ ZNode *znode_new(const char *name, size_t len, double score) {
 }
 
 void tree_add(ZSet *zset, ZNode *node) {
-    if (!(zset->tree)) {
-        zset->tree = &(node->tree);
-        return;
-    }
-
-    AVLNode *curr = zset->tree;
-    while (true) {
-        AVLNode **from = zless(&node->tree, curr) ? &curr->left : &curr->right;
-
-        if (!*from) {
-            *from = &(node->tree);
-            node->tree.parent = curr;
-            zset->tree = avl_rebalance(&(node->tree));
-            break;
-        }
-
-        curr = *from;
-    }
+    zset->tree = avl_insert(zset->tree, &node->tree,
+                            [](AVLNode *lhs, AVLNode *rhs) {
+                                return zless(lhs, rhs);
+                            });
 }
 
 bool zless(AVLNode *lhs, double score, const char *name, size_t len) {
@@ -70,10 +63,12 @@ void zset_update(ZSet *zset, ZNode *node, double score) {
         return;
     }
 
+    h_seq_begin(&zset->seq);
     zset->tree = avl_delete(&(node->tree));
     node->score = score;
     avl_init(&(node->tree));
     tree_add(zset, node);
+    h_seq_end(&zset->seq);
 }
 
 bool zset_add(ZSet *zset, const char *name, size_t len, double score) {
@@ -83,25 +78,27 @@ bool zset_add(ZSet *zset, const char *name, size_t len, double score) {
         return false;
     } else {
         node = znode_new(name, len, score);
-        hm_insert(&(zset->hmap), &(node->hmap));
+        hi_insert(&(zset->hmap), &(node->hmap));
+        zset->bytes += slab_size(sizeof(ZNode) + len);
+        zset->names += len;
+        h_seq_begin(&zset->seq);
         tree_add(zset, node);
+        h_seq_end(&zset->seq);
         return true;
     }
 }
 
+static bool znode_is(ZNode *znode, const char *name, size_t len) {
+    return znode->len == len && 0 == memcmp(znode->name, name, len);
+}
+
 bool hcmp(HNode *node, HNode *key) {
     if (node->hcode != key->hcode) {
         return false;
     }
 
-    ZNode *znode = container_of(node, ZNode, hmap);
     HKey *hkey = container_of(key, HKey, node);
-
-    if (znode->len != hkey->len) {
-        return false;
-    }
-
-    return 0 == memcmp(znode->name, hkey->name, znode->len);
+    return znode_is(container_of(node, ZNode, hmap), hkey->name, hkey->len);
 }
 
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
@@ -109,33 +106,35 @@ ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
         return nullptr;
     }
 
-    HKey key;
-    key.node.hcode = str_hash((uint8_t *)name, len);
-    key.name = name;
-    key.len = len;
-
-    HNode *found = hm_lookup(&(zset->hmap), &(key.node), &hcmp);
+    return hi_find(&zset->hmap, &ZNode::hmap, str_hash((uint8_t *)name, len),
+                   [&](ZNode *znode) { return znode_is(znode, name, len); });
+}
 
-    if (!found) {
-        return nullptr;
+void zset_lookup_many(ZSet *zset, const std::string_view *names, size_t n,
+                      ZNode **out) {
+    uint64_t hcodes[K_PREFETCH_BATCH];
+    for (size_t base = 0; base < n; base += K_PREFETCH_BATCH) {
+        size_t batch = std::min(n - base, K_PREFETCH_BATCH);
+        const std::string_view *batch_names = &names[base];
+        for (size_t i = 0; i < batch; ++i) {
+            hcodes[i] = str_hash((uint8_t *)batch_names[i].data(),
+                                 batch_names[i].size());
+        }
+        hi_find_batch(
+            &zset->hmap, &ZNode::hmap, hcodes, batch,
+            [&](size_t i, ZNode *znode) {
+                return znode_is(znode, batch_names[i].data(),
+                                batch_names[i].size());
+            },
+            &out[base]);
     }
-
-    return container_of(found, ZNode, hmap);
 }
 
 ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len,
                   int64_t offset) {
-    AVLNode *found = nullptr;
-    AVLNode *curr = zset->tree;
-
-    while (curr) {
-        if (zless(curr, score, name, len)) {
-            curr = curr->right;
-        } else {
-            found = curr;
-            curr = curr->left;
-        }
-    }
+    AVLNode *found = avl_lower_bound(zset->tree, [&](AVLNode *node) {
+        return zless(node, score, name, len);
+    });
 
     if (found) {
         found = avl_offset(found, offset);
@@ -149,22 +148,81 @@ ZNode *zset_pop(ZSet *zset, const char *name, size_t len) {
         return nullptr;
     }
 
-    HKey key;
-    key.node.hcode = str_hash((uint8_t *)name, len);
-    key.name = name;
-    key.len = len;
-    HNode *found = hm_pop(&zset->hmap, &key.node, &hcmp);
-
-    if (!found) {
+    ZNode *node =
+        hi_take(&zset->hmap, &ZNode::hmap, str_hash((uint8_t *)name, len),
+                [&](ZNode *znode) { return znode_is(znode, name, len); });
+    if (!node) {
         return nullptr;
     }
 
-    ZNode *node = container_of(found, ZNode, hmap);
+    h_seq_begin(&zset->seq);
     zset->tree = avl_delete(&node->tree);
+    h_seq_end(&zset->seq);
+    zset->bytes -= slab_size(sizeof(ZNode) + len);
+    zset->names -= len;
     return node;
 }
 
-void znode_del(ZNode *node) { free(node); }
+bool zset_score_shared(ZSet *zset, const char *name, size_t len,
+                       double *score) {
+    uint64_t hcode = str_hash((uint8_t *)name, len);
+    while (true) {
+        uint64_t v = h_seq_read(&zset->seq);
+        ZNode *node = hi_find_shared(
+            &zset->hmap, &ZNode::hmap, hcode,
+            [&](ZNode *znode) { return znode_is(znode, name, len); });
+        double found = node ? node->score : 0;
+        if (!h_seq_changed(&zset->seq, v)) {
+            *score = found;
+            return node != nullptr;
+        }
+    }
+}
+
+void zset_query_shared(ZSet *zset, double score, const char *name, size_t len,
+                       int64_t offset, int64_t limit, std::vector<ZHit> &out) {
+    while (true) {
+        out.clear();
+        uint64_t v = h_seq_read(&zset->seq);
+        // any change ends the walk, so does a path too long for a valid tree
+        bool torn = false;
+        size_t hops = 0;
+        auto valid = [&] {
+            torn = torn || ++hops > K_ZSET_MAX_HOPS ||
+                   h_seq_changed(&zset->seq, v);
+            return !torn;
+        };
+
+        AVLNode *found = nullptr;
+        AVLNode *node = zset->tree;
+        while (node && valid()) {
+            if (zless(node, score, name, len)) {
+                node = node->right;
+            } else {
+                found = node;
+                node = node->left;
+            }
+        }
+        hops = 0;
+        node = found && !torn ? avl_offset_if(found, offset, valid) : nullptr;
+        while (node && !torn && (int64_t)out.size() < limit) {
+            ZNode *znode = container_of(node, ZNode, tree);
+            out.push_back(ZHit{znode, znode->score});
+            hops = 0;
+            node = avl_offset_if(node, +1, valid);
+        }
+
+        if (!torn && !h_seq_changed(&zset->seq, v)) {
+            return;
+        }
+    }
+}
+
+size_t zset_mem(ZSet *zset) {
+    return slab_size(sizeof(ZSet)) + zset->bytes + hi_mem_usage(&zset->hmap);
+}
+
+void znode_del(ZNode *node) { slab_free(node, sizeof(ZNode) + node->len); }
 
 void tree_dispose(AVLNode *node) {
     if (!node)
@@ -178,5 +236,5 @@ void tree_dispose(AVLNode *node) {
 
 void zset_dispose(ZSet *zset) {
     tree_dispose(zset->tree);
-    hm_destroy(&zset->hmap);
+    hi_destroy(&zset->hmap);
 }
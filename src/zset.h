@@ -3,12 +3,18 @@
 
 #include "avl.h"
 #include "hashtable.h"
+#include "omap.h"
 #include <cstddef>
 #include <cstdint>
+#include <string_view>
+#include <vector>
 
 struct ZSet {
     AVLNode *tree = nullptr;
-    HMap hmap;
+    HIndex hmap;
+    uint64_t seq = 0; // odd while being changed, see `h_seq_begin()`
+    size_t bytes = 0; // of the nodes, as allocated
+    size_t names = 0; // bytes of the member names
 };
 
 /**
@@ -61,6 +67,13 @@ bool hcmp(HNode *node, HNode *key);
  */
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len);
 
+/**
+ * `zset_lookup()` of `n` names, `K_PREFETCH_BATCH` at a time (see
+ * `hm_find_batch()`); NULL for the missing ones
+ */
+void zset_lookup_many(ZSet *zset, const std::string_view *names, size_t n,
+                      ZNode **out);
+
 /**
  * Primary usecase of the sorted sets: range query
  * Find the _smallest_ (score, name) tuple that is >= the argument,
@@ -74,6 +87,27 @@ ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len,
  */
 ZNode *zset_pop(ZSet *zset, const char *name, size_t len);
 
+/**
+ * Reads from a thread other than the writer (`--shared-reads`), on a set
+ * kept alive by `ebr_enter()`; the removed nodes must be retired as well
+ * The tree may be changed under the reader, a read is retried until it ran
+ * without any change in between (`ZSet::seq`)
+ */
+bool zset_score_shared(ZSet *zset, const char *name, size_t len,
+                       double *score);
+
+struct ZHit {
+    ZNode *node;
+    double score;
+};
+
+// `zset_query()` then the `limit - 1` nodes after it
+void zset_query_shared(ZSet *zset, double score, const char *name, size_t len,
+                       int64_t offset, int64_t limit, std::vector<ZHit> &out);
+
+// what the set takes, `ZSet` included, as `slab_allocated()` counts it
+size_t zset_mem(ZSet *zset);
+
 void tree_dispose(AVLNode *node);
 void zset_dispose(ZSet *zset);
 